@@ -30,12 +30,39 @@
  */
 #pragma once
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <iterator>
 #include <list>
+#include <map>
+#include <memory>
+#if __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#endif
+#endif
 #include <mutex>
 #include <stdexcept>
+#include <string>
 #include <thread>
+#include <tuple>
+#include <type_traits>
 #include <unordered_map>
+#include <utility>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define LRU11_HAVE_MMAP 1
+#endif
 
 namespace lru11 {
 /*
@@ -49,192 +76,3319 @@ class NullLock {
 };
 
 /**
- * error raised when a key not in cache is passed to get()
+ * error raised when a key not in cache is passed to get()
+ */
+class KeyNotFound : public std::invalid_argument {
+ public:
+  KeyNotFound() : std::invalid_argument("key_not_found") {}
+};
+
+/**
+ * why an entry left the cache, as reported to the removal listener
+ */
+enum class RemovalCause {
+  kSize,      // evicted by prune() for maxSize / maxWeight
+  kExpired,   // its time to live ran out
+  kExplicit,  // remove() or clear()
+  kReplaced   // its value was overwritten, the listener gets the old one
+};
+
+/**
+ * what Cache::beginLoad() found for a key
+ */
+enum class LoadState {
+  kHit,   // the key is cached, its value was copied out
+  kWait,  // another caller is loading it, onReady will be called
+  kLoad,  // the caller now owns the load and must endLoad() / failLoad()
+  kMiss   // not cached and not loading, nothing was claimed
+};
+
+template <typename K, typename V>
+struct KeyValuePair {
+ public:
+  K key;
+  V value;
+
+  KeyValuePair(K k, V v) : key(std::move(k)), value(std::move(v)) {}
+  // constructs the value in place from args (used by emplace)
+  template <class KArg, class... Args>
+  KeyValuePair(std::piecewise_construct_t, KArg&& k, Args&&... args)
+      : key(std::forward<KArg>(k)), value(std::forward<Args>(args)...) {}
+};
+
+namespace detail {
+/*
+ * reserves the map slot for k with a single lookup where the map has
+ * try_emplace (C++17), otherwise find + emplace. returns the slot and
+ * whether it was newly added (its mapped value is then a placeholder).
+ */
+template <class M, class K>
+auto tryEmplace(M& m, const K& k, int)
+    -> decltype(m.try_emplace(k, typename M::mapped_type())) {
+  return m.try_emplace(k, typename M::mapped_type());
+}
+template <class M, class K>
+std::pair<typename M::iterator, bool> tryEmplace(M& m, const K& k, long) {
+  const auto iter = m.find(k);
+  if (iter != m.end()) {
+    return std::make_pair(iter, false);
+  }
+  return m.emplace(k, typename M::mapped_type());
+}
+
+/*
+ * lock types that also offer lock_shared()/unlock_shared() (e.g.
+ * std::shared_timed_mutex or std::shared_mutex)
+ */
+template <class L, class = void>
+struct is_shared_lockable : std::false_type {};
+template <class L>
+struct is_shared_lockable<
+    L, decltype(std::declval<L&>().lock_shared(), void())>
+    : std::true_type {};
+
+/*
+ * takes a shared lock where the lock type supports it and falls back to an
+ * exclusive lock otherwise
+ */
+template <class L, bool = is_shared_lockable<L>::value>
+class SharedGuard {
+ public:
+  explicit SharedGuard(L& l) : l_(l) { l_.lock_shared(); }
+  ~SharedGuard() { l_.unlock_shared(); }
+
+ private:
+  SharedGuard(const SharedGuard&) = delete;
+  SharedGuard& operator=(const SharedGuard&) = delete;
+  L& l_;
+};
+template <class L>
+class SharedGuard<L, false> : public std::lock_guard<L> {
+ public:
+  explicit SharedGuard(L& l) : std::lock_guard<L>(l) {}
+};
+
+/*
+ * Cache lets Map name the container family (std::unordered_map / std::map)
+ * and rebinds its mapped type to the iterator of the actual node list, so
+ * e.g. std::map<Key, Value> or std::unordered_map<Key, Value, MyHash> can be
+ * passed. any other map must already map Key to list_type::iterator.
+ * Alloc, unless void, replaces the allocator of the std maps (kRebound
+ * tells whether it did)
+ */
+template <class M, class It, class Alloc = void>
+struct RebindMap {
+  typedef M type;
+  static const bool kRebound = false;
+};
+template <class A, class Alloc, class T>
+struct RebindAlloc {
+  typedef typename std::allocator_traits<typename std::conditional<
+      std::is_void<Alloc>::value, A, Alloc>::type>::template rebind_alloc<T>
+      type;
+};
+template <class K, class T, class H, class E, class A, class It, class Alloc>
+struct RebindMap<std::unordered_map<K, T, H, E, A>, It, Alloc> {
+  typedef std::unordered_map<
+      K, It, H, E,
+      typename RebindAlloc<A, Alloc, std::pair<const K, It>>::type>
+      type;
+  static const bool kRebound = !std::is_void<Alloc>::value;
+};
+template <class K, class T, class C, class A, class It, class Alloc>
+struct RebindMap<std::map<K, T, C, A>, It, Alloc> {
+  typedef std::map<K, It, C,
+                   typename RebindAlloc<A, Alloc, std::pair<const K, It>>::type>
+      type;
+  static const bool kRebound = !std::is_void<Alloc>::value;
+};
+// a container using allocator a, if it takes one
+template <class C, class A>
+C makeContainer(const A& a, std::true_type) {
+  return C(typename C::allocator_type(a));
+}
+template <class C, class A>
+C makeContainer(const A&, std::false_type) {
+  return C();
+}
+
+/*
+ * a Key -> T map of the same kind as the cache map (same hash / compare),
+ * std::map<Key, T> if the cache map is not a std map
+ */
+template <class M, class Key, class T>
+struct SideMap {
+  typedef std::map<Key, T> type;
+};
+template <class K, class U, class H, class E, class A, class Key, class T>
+struct SideMap<std::unordered_map<K, U, H, E, A>, Key, T>
+    : RebindMap<std::unordered_map<K, U, H, E, A>, T> {};
+template <class K, class U, class C, class A, class Key, class T>
+struct SideMap<std::map<K, U, C, A>, Key, T>
+    : RebindMap<std::map<K, U, C, A>, T> {};
+
+/*
+ * an in flight load: its result, for blocking getOrLoad() callers, and the
+ * callbacks of the asynchronous ones, run once the result is set
+ */
+template <class Value>
+struct Flight {
+  Flight() : result(done.get_future().share()) {}
+  std::promise<Value> done;
+  std::shared_future<Value> result;
+  std::vector<std::function<void(const std::shared_future<Value>&)>> waiters;
+};
+
+/*
+ * spreads the bits of a std::hash style result (which is often the identity
+ * for integral keys) so the high bits can be used for shard selection
+ */
+inline uint64_t mixHash(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+/*
+ * hints the cache line holding p into cache ahead of use, for batched
+ * lookups (no-op where the compiler has no prefetch builtin)
+ */
+inline void prefetch(const void* p) {
+#if defined(__GNUC__) || defined(__clang__)
+  __builtin_prefetch(p);
+#else
+  (void)p;
+#endif
+}
+
+template <class>
+struct to_void {
+  typedef void type;
+};
+template <class T, class = void>
+struct has_is_transparent : std::false_type {};
+template <class T>
+struct has_is_transparent<T, typename to_void<typename T::is_transparent>::type>
+    : std::true_type {};
+
+/*
+ * maps whose find() accepts any type comparable with the key: ordered maps
+ * with a transparent key_compare (std::map, C++14) and hashed maps with a
+ * transparent hasher and key_equal (std::unordered_map, C++20)
+ */
+template <class M, class = void>
+struct is_transparent_ordered : std::false_type {};
+template <class M>
+struct is_transparent_ordered<M,
+                              typename to_void<typename M::key_compare>::type>
+    : has_is_transparent<typename M::key_compare> {};
+template <class M, class = void>
+struct is_transparent_hashed : std::false_type {};
+template <class M>
+struct is_transparent_hashed<M, typename to_void<typename M::hasher>::type>
+    : std::integral_constant<
+          bool, has_is_transparent<typename M::hasher>::value &&
+                    has_is_transparent<typename M::key_equal>::value> {};
+// maps with a key_compare keep their keys sorted (std::map, BTreeMap)
+template <class M, class = void>
+struct is_ordered_map : std::false_type {};
+template <class M>
+struct is_ordered_map<M, typename to_void<typename M::key_compare>::type>
+    : std::true_type {};
+// key begins with prefix, for keys that are sequences (strings, vectors)
+template <class K>
+bool hasPrefix(const K& key, const K& prefix) {
+  return key.size() >= prefix.size() &&
+         std::equal(prefix.begin(), prefix.end(), key.begin());
+}
+template <class M>
+struct is_transparent_map
+    : std::integral_constant<bool, is_transparent_ordered<M>::value ||
+                                       is_transparent_hashed<M>::value> {};
+
+inline size_t threadStripe() {
+  static thread_local const size_t id = static_cast<size_t>(mixHash(
+      std::hash<std::thread::id>()(std::this_thread::get_id())));
+  return id;
+}
+}  // namespace detail
+
+/**
+ *	An eviction policy decides what a cache hit does to the recency list
+ *and which node prune() evicts. A policy is a class with
+ *
+ *		node<Key, Value>::type - the list node (KeyValuePair or derived)
+ *		impl<List> - the per cache state, see LRUPolicy::impl
+ *
+ *	LRUPolicy is the classic strict LRU: every hit splices the node to the
+ *front of the list, so reads need the exclusive lock.
+ */
+struct LRUPolicy {
+  template <class K, class V>
+  struct node {
+    typedef KeyValuePair<K, V> type;
+  };
+  template <class List>
+  class impl {
+   public:
+    typedef typename List::iterator iterator;
+    // hits leave the list alone, reads may share the lock
+    static const bool kSharedReads = false;
+
+    // called once from the Cache constructor
+    void init(List&, size_t /*maxSize*/, size_t /*elasticity*/) {}
+    // called by setMaxSize() / setElasticity(), the list may be non empty
+    void resize(List&, size_t /*maxSize*/, size_t /*elasticity*/) {}
+    void onInsert(List&, iterator) {}
+    void onHit(List& l, iterator it) { l.splice(l.begin(), l, it); }
+    void onErase(List&, iterator) {}
+    iterator victim(List& l) { return std::prev(l.end()); }
+    // true when deferred hits should be applied soon via sync()
+    bool pendingFull() const { return false; }
+    // applies deferred hits, called with the exclusive lock held
+    void sync(List&) {}
+    // called before the list is cleared
+    void clear(List&) {}
+  };
+};
+
+/**
+ *	BufferedLRUPolicy defers the LRU promotion of a hit: the hit is only
+ *recorded in a small per-thread-striped read buffer and the buffered
+ *promotions are replayed in one batch under the exclusive lock (on the next
+ *write, or by a reader once its stripe fills up), in the style of Caffeine's
+ *read buffers.
+ *
+ *	Hits don't write to the list, so with a shared-lockable Lock (e.g.
+ *std::shared_timed_mutex) the get paths only take a shared lock and readers
+ *no longer serialize. When a stripe is full further hits are dropped until
+ *it is drained, which makes the recency order approximate.
+ */
+struct BufferedLRUPolicy {
+  template <class K, class V>
+  struct node {
+    typedef KeyValuePair<K, V> type;
+  };
+  template <class List>
+  class impl {
+   public:
+    typedef typename List::iterator iterator;
+    static const bool kSharedReads = true;
+
+    impl() {
+      for (auto& s : stripes_) {
+        s.tail.store(0, std::memory_order_relaxed);
+      }
+    }
+    void init(List&, size_t, size_t) {}
+    void resize(List&, size_t, size_t) {}
+    void onInsert(List&, iterator) {}
+    void onHit(List&, iterator it) {
+      Stripe& s = stripeOf();
+      const size_t i = s.tail.fetch_add(1, std::memory_order_relaxed);
+      if (i < kStripeSize) {
+        s.slots[i] = it;
+      }
+    }
+    void onErase(List&, iterator) {}
+    iterator victim(List& l) { return std::prev(l.end()); }
+    bool pendingFull() const {
+      return stripeOf().tail.load(std::memory_order_relaxed) >= kStripeSize;
+    }
+    void sync(List& l) {
+      for (auto& s : stripes_) {
+        const size_t n = std::min<size_t>(
+            s.tail.load(std::memory_order_relaxed), kStripeSize);
+        for (size_t i = 0; i < n; ++i) {
+          l.splice(l.begin(), l, s.slots[i]);
+        }
+        s.tail.store(0, std::memory_order_relaxed);
+      }
+    }
+    void clear(List&) {
+      for (auto& s : stripes_) {
+        s.tail.store(0, std::memory_order_relaxed);
+      }
+    }
+
+   private:
+    enum : size_t { kStripes = 8, kStripeSize = 32 };
+    struct Stripe {
+      std::atomic<size_t> tail;
+      char pad[64 - sizeof(std::atomic<size_t>)];
+      iterator slots[kStripeSize];
+    };
+    Stripe& stripeOf() {
+      return stripes_[detail::threadStripe() & (kStripes - 1)];
+    }
+    const Stripe& stripeOf() const {
+      return stripes_[detail::threadStripe() & (kStripes - 1)];
+    }
+    Stripe stripes_[kStripes];
+  };
+};
+
+/**
+ *	list node for ClockPolicy, a KeyValuePair plus the reference bit
+ */
+template <typename K, typename V>
+struct ClockNode : public KeyValuePair<K, V> {
+ public:
+  mutable std::atomic<bool> referenced;
+
+  ClockNode(K k, V v)
+      : KeyValuePair<K, V>(std::move(k), std::move(v)), referenced(false) {}
+  template <class... Args>
+  ClockNode(std::piecewise_construct_t pc, Args&&... args)
+      : KeyValuePair<K, V>(pc, std::forward<Args>(args)...), referenced(false) {}
+};
+
+/**
+ *	ClockPolicy is CLOCK (second chance) eviction: a hit only sets the
+ *node's reference bit, and prune() sweeps a hand from the LRU end, giving
+ *referenced nodes a second chance (clear the bit, move them to the front)
+ *and evicting the first unreferenced one. The list is the ring and moving
+ *the back node to the front is the hand advancing over it.
+ *
+ *	Hits don't touch the list (and don't write at all if the bit is already
+ *set), so reads may share the lock. maxSize/elasticity work as for LRU.
+ */
+struct ClockPolicy {
+  template <class K, class V>
+  struct node {
+    typedef ClockNode<K, V> type;
+  };
+  template <class List>
+  class impl {
+   public:
+    typedef typename List::iterator iterator;
+    static const bool kSharedReads = true;
+
+    void init(List&, size_t, size_t) {}
+    void resize(List&, size_t, size_t) {}
+    void onInsert(List&, iterator) {}
+    void onHit(List&, iterator it) {
+      if (!it->referenced.load(std::memory_order_relaxed)) {
+        it->referenced.store(true, std::memory_order_relaxed);
+      }
+    }
+    void onErase(List&, iterator) {}
+    iterator victim(List& l) {
+      for (;;) {
+        const iterator hand = std::prev(l.end());
+        if (!hand->referenced.load(std::memory_order_relaxed)) {
+          return hand;
+        }
+        hand->referenced.store(false, std::memory_order_relaxed);
+        l.splice(l.begin(), l, hand);
+      }
+    }
+    bool pendingFull() const { return false; }
+    void sync(List&) {}
+    void clear(List&) {}
+  };
+};
+
+/**
+ *	A count-min sketch of 4 bit counters (16 per 64 bit word, 4 rows) used
+ *to estimate how often a key was seen recently. Every sampleSize recorded
+ *increments all counters are halved, so old popularity fades out.
+ */
+class FrequencySketch {
+ public:
+  explicit FrequencySketch(size_t capacity = 0) { reset(capacity); }
+
+  void reset(size_t capacity) {
+    size_t words = 8;
+    while (words < capacity) {
+      words <<= 1;
+    }
+    table_.assign(words, 0);
+    mask_ = words - 1;
+    sampleSize_ = 10 * std::max<size_t>(capacity, 1);
+    additions_ = 0;
+  }
+  // the number of counter words, at least the capacity it was reset to
+  size_t width() const { return table_.size(); }
+  void increment(uint64_t h) {
+    bool added = false;
+    for (unsigned i = 0; i < kDepth; ++i) {
+      uint64_t& word = table_[slot(h, i)];
+      const unsigned shift = counterShift(h, i);
+      if (((word >> shift) & 0xf) != 0xf) {
+        word += uint64_t(1) << shift;
+        added = true;
+      }
+    }
+    if (added && ++additions_ >= sampleSize_) {
+      age();
+    }
+  }
+  unsigned frequency(uint64_t h) const {
+    unsigned f = 0xf;
+    for (unsigned i = 0; i < kDepth; ++i) {
+      const unsigned c = static_cast<unsigned>(
+          (table_[slot(h, i)] >> counterShift(h, i)) & 0xf);
+      f = std::min(f, c);
+    }
+    return f;
+  }
+  void clear() {
+    std::fill(table_.begin(), table_.end(), 0);
+    additions_ = 0;
+  }
+
+ private:
+  enum : unsigned { kDepth = 4 };
+  // double hashing: row i probes a + i * b
+  static uint64_t probe(uint64_t h, unsigned i) {
+    const uint64_t a = detail::mixHash(h);
+    return a + i * ((a >> 32) | 1);
+  }
+  size_t slot(uint64_t h, unsigned i) const {
+    return static_cast<size_t>(probe(h, i)) & mask_;
+  }
+  static unsigned counterShift(uint64_t h, unsigned i) {
+    return static_cast<unsigned>((probe(h, i) >> 58) & 0xf) << 2;
+  }
+  void age() {
+    for (auto& word : table_) {
+      word = (word >> 1) & 0x7777777777777777ULL;
+    }
+    additions_ /= 2;
+  }
+
+  std::vector<uint64_t> table_;
+  size_t mask_;
+  size_t sampleSize_;
+  size_t additions_;
+};
+
+/**
+ *	list node for TinyLFUPolicy, a KeyValuePair plus the segment it is in
+ */
+template <typename K, typename V>
+struct TinyLFUNode : public KeyValuePair<K, V> {
+ public:
+  typedef K key_type;
+  uint8_t segment;
+
+  TinyLFUNode(K k, V v)
+      : KeyValuePair<K, V>(std::move(k), std::move(v)), segment(0) {}
+  template <class... Args>
+  TinyLFUNode(std::piecewise_construct_t pc, Args&&... args)
+      : KeyValuePair<K, V>(pc, std::forward<Args>(args)...), segment(0) {}
+};
+
+/**
+ *	TinyLFUPolicy is W-TinyLFU: a small LRU window (1% of maxSize) in front
+ *of a segmented LRU main region (80% protected, the rest probation), and a
+ *FrequencySketch (keys hashed with std::hash) that is updated on every
+ *insert and hit.
+ *
+ *	New entries go to the window. When prune() has to evict while the
+ *window is over its share, the window's LRU entry (the candidate) competes
+ *with the main region's LRU entry (the victim): the one the sketch has seen
+ *less often is evicted and a winning candidate moves to probation. A hit in
+ *probation promotes the entry to protected, demoting the protected LRU
+ *entry if needed. One-hit-wonder scans therefore churn through the window
+ *without flushing the frequently used entries.
+ *
+ *	All three segments live in the cache's one list (front to back: window,
+ *protected, probation) so map iterators stay valid and cwalk() sees every
+ *entry.
+ */
+struct TinyLFUPolicy {
+  template <class K, class V>
+  struct node {
+    typedef TinyLFUNode<K, V> type;
+  };
+  template <class List>
+  class impl {
+   public:
+    typedef typename List::iterator iterator;
+    typedef typename List::value_type::key_type key_type;
+    static const bool kSharedReads = false;
+
+    void init(List& l, size_t maxSize, size_t /*elasticity*/) {
+      protBegin_ = probBegin_ = l.end();
+      count_[kWindow] = count_[kProtected] = count_[kProbation] = 0;
+      setLimits(maxSize);
+      sketch_.reset(maxSize);
+    }
+    // the segments keep their entries and converge to the new shares as
+    // victim() and onHit() move nodes. a sketch too small for the new size
+    // is rebuilt, which forgets the frequencies seen so far
+    void resize(List&, size_t maxSize, size_t /*elasticity*/) {
+      setLimits(maxSize);
+      if (maxSize > sketch_.width()) {
+        sketch_.reset(maxSize);
+      }
+    }
+    void onInsert(List&, iterator it) {
+      // the cache put the node at the front, which is the window's MRU end
+      it->segment = kWindow;
+      ++count_[kWindow];
+      record(it);
+    }
+    void onHit(List& l, iterator it) {
+      record(it);
+      if (it->segment == kProbation) {
+        place(l, it, kProtected);
+        if (count_[kProtected] > protectedMax_) {
+          place(l, std::prev(probBegin_), kProbation);
+        }
+      } else {
+        place(l, it, it->segment);
+      }
+    }
+    void onErase(List&, iterator it) {
+      if (it == protBegin_) {
+        protBegin_ = std::next(it);
+      }
+      if (it == probBegin_) {
+        probBegin_ = std::next(it);
+      }
+      --count_[it->segment];
+    }
+    iterator victim(List& l) {
+      for (;;) {
+        if (count_[kWindow] <= windowMax_) {
+          return std::prev(l.end());
+        }
+        const iterator candidate = std::prev(protBegin_);
+        if (count_[kProtected] + count_[kProbation] < mainMax_) {
+          place(l, candidate, kProbation);
+          continue;
+        }
+        const iterator main = std::prev(l.end());
+        if (frequency(candidate) > frequency(main)) {
+          place(l, candidate, kProbation);
+          return main;
+        }
+        return candidate;
+      }
+    }
+    bool pendingFull() const { return false; }
+    void sync(List&) {}
+    void clear(List& l) {
+      protBegin_ = probBegin_ = l.end();
+      count_[kWindow] = count_[kProtected] = count_[kProbation] = 0;
+      sketch_.clear();
+    }
+
+   private:
+    enum : uint8_t { kWindow = 0, kProtected = 1, kProbation = 2 };
+
+    void setLimits(size_t maxSize) {
+      if (maxSize == 0) {
+        windowMax_ = mainMax_ = protectedMax_ = size_t(-1);
+      } else {
+        windowMax_ = std::max<size_t>(1, maxSize / 100);
+        mainMax_ = maxSize > windowMax_ ? maxSize - windowMax_ : 0;
+        protectedMax_ = std::max<size_t>(1, mainMax_ * 4 / 5);
+      }
+    }
+    uint64_t hashOf(iterator it) const {
+      return static_cast<uint64_t>(std::hash<key_type>()(it->key));
+    }
+    void record(iterator it) { sketch_.increment(hashOf(it)); }
+    unsigned frequency(iterator it) const {
+      return sketch_.frequency(hashOf(it));
+    }
+    // moves a node to the MRU end of a segment, keeping the segment
+    // boundaries (first protected / first probation node) up to date
+    void place(List& l, iterator it, uint8_t segment) {
+      if (it == protBegin_) {
+        protBegin_ = std::next(it);
+      }
+      if (it == probBegin_) {
+        probBegin_ = std::next(it);
+      }
+      --count_[it->segment];
+      if (segment == kWindow) {
+        l.splice(l.begin(), l, it);
+      } else if (segment == kProtected) {
+        l.splice(protBegin_, l, it);
+        protBegin_ = it;
+      } else {
+        const bool protectedEmpty = (protBegin_ == probBegin_);
+        l.splice(probBegin_, l, it);
+        probBegin_ = it;
+        if (protectedEmpty) {
+          protBegin_ = it;
+        }
+      }
+      it->segment = segment;
+      ++count_[segment];
+    }
+
+    iterator protBegin_;
+    iterator probBegin_;
+    size_t count_[3];
+    size_t windowMax_;
+    size_t mainMax_;
+    size_t protectedMax_;
+    FrequencySketch sketch_;
+  };
+};
+
+/**
+ *	the default weigher: entries have no weight and only the entry count
+ *(maxSize/elasticity) bounds the cache
+ */
+struct NoWeigher {
+  template <class K, class V>
+  size_t operator()(const K&, const V&) const {
+    return 0;
+  }
+};
+
+/**
+ *	the default expiry: entries never expire and the node carries no time
+ */
+struct NoExpiry {
+  template <class Node>
+  struct node {
+    typedef Node type;
+  };
+  template <class List>
+  class impl {
+   public:
+    typedef typename List::value_type node_type;
+    typedef std::chrono::nanoseconds duration;
+    static const bool kEnabled = false;
+
+    void setDefaultTtl(duration) {}
+    duration defaultTtl() const { return duration::zero(); }
+    void setRefreshAfter(duration) {}
+    void schedule(node_type&, duration) {}
+    void unschedule(node_type&) {}
+    bool expired(const node_type&) const { return false; }
+    bool claimRefresh(const node_type&) const { return false; }
+    void armRefresh(node_type&) {}
+    template <class F>
+    void advance(F) {}
+    void clear() {}
+  };
+};
+
+namespace detail {
+/*
+ * intrusive doubly linked hook for the timing wheel, the wheel slots are
+ * circular lists with a sentinel
+ */
+struct WheelLink {
+  WheelLink* prev;
+  WheelLink* next;
+
+  WheelLink() : prev(nullptr), next(nullptr) {}
+  bool linked() const { return next != nullptr; }
+  void linkAfter(WheelLink* head) {
+    next = head->next;
+    prev = head;
+    head->next->prev = this;
+    head->next = this;
+  }
+  void unlink() {
+    prev->next = next;
+    next->prev = prev;
+    prev = next = nullptr;
+  }
+};
+}  // namespace detail
+
+/**
+ *	list node for TimedExpiry, the policy's node plus the expiry time, the
+ *timing wheel hook and the refresh time
+ */
+template <class Base, class TimePoint>
+struct TtlNode : public Base, public detail::WheelLink {
+ public:
+  typedef typename TimePoint::rep rep;
+  // TimePoint::max() = never expires
+  TimePoint expireAt;
+  uint64_t expireTick;
+  // clock ticks when a hit should trigger a refresh, max() = not armed.
+  // atomic, as hits may claim it under a shared lock
+  mutable std::atomic<rep> refreshAt;
+
+  template <class... Args>
+  explicit TtlNode(Args&&... args)
+      : Base(std::forward<Args>(args)...),
+        expireAt(TimePoint::max()),
+        expireTick(0),
+        refreshAt(TimePoint::max().time_since_epoch().count()) {}
+};
+
+/**
+ *	TimedExpiry gives entries a time to live, either per insert() or the
+ *cache wide default (setDefaultTtl(), zero = never expire).
+ *
+ *	Expiry is checked lazily: an expired entry is a miss for get/tryGet/
+ *contains and is skipped by cwalk(). Expired entries are reclaimed
+ *incrementally by a hierarchical timing wheel (4 levels of 64 slots, 1ms
+ *ticks at the bottom) that insert() advances to the current time, so there
+ *is never a full scan and no background thread. Until then an expired entry
+ *still counts towards size().
+ *
+ *		Clock - a std::chrono style clock (default: std::chrono::steady_clock)
+ */
+template <class Clock = std::chrono::steady_clock>
+struct TimedExpiry {
+  template <class Node>
+  struct node {
+    typedef TtlNode<Node, typename Clock::time_point> type;
+  };
+  template <class List>
+  class impl {
+   public:
+    typedef typename List::value_type node_type;
+    typedef typename Clock::time_point time_point;
+    typedef typename Clock::duration duration;
+    typedef typename time_point::rep rep;
+    static const bool kEnabled = true;
+
+    impl()
+        : defaultTtl_(duration::zero()),
+          refreshAfter_(duration::zero()),
+          epoch_(Clock::now()),
+          current_(0),
+          scheduled_(0) {
+      resetSlots();
+    }
+
+    void setDefaultTtl(duration ttl) { defaultTtl_ = ttl; }
+    duration defaultTtl() const { return defaultTtl_; }
+    void setRefreshAfter(duration d) { refreshAfter_ = d; }
+    // (re)starts the entry's time to live, zero or less = never expire
+    void schedule(node_type& n, duration ttl) {
+      armRefresh(n);
+      unschedule(n);
+      if (ttl <= duration::zero()) {
+        n.expireAt = time_point::max();
+        return;
+      }
+      n.expireAt = Clock::now() + ttl;
+      // an entry that isn't quite due when its tick fires is re-placed
+      n.expireTick = tickOf(n.expireAt);
+      place(n);
+      ++scheduled_;
+    }
+    void unschedule(node_type& n) {
+      if (n.linked()) {
+        n.unlink();
+        --scheduled_;
+      }
+    }
+    bool expired(const node_type& n) const {
+      return n.expireAt != time_point::max() && Clock::now() >= n.expireAt;
+    }
+    // true for the one caller that takes a due refresh (it is disarmed
+    // until the entry is written again)
+    bool claimRefresh(const node_type& n) const {
+      const rep never = time_point::max().time_since_epoch().count();
+      rep due = n.refreshAt.load(std::memory_order_relaxed);
+      if (due == never || Clock::now().time_since_epoch().count() < due) {
+        return false;
+      }
+      return n.refreshAt.compare_exchange_strong(due, never);
+    }
+    void armRefresh(node_type& n) {
+      n.refreshAt.store(refreshAfter_ > duration::zero()
+                            ? (Clock::now() + refreshAfter_)
+                                  .time_since_epoch()
+                                  .count()
+                            : time_point::max().time_since_epoch().count(),
+                        std::memory_order_relaxed);
+    }
+    // moves the wheel to the current time, onExpired(node_type&) is called
+    // for every expired entry (already unscheduled)
+    template <class F>
+    void advance(F onExpired) {
+      const uint64_t target = tickOf(Clock::now());
+      while (current_ < target) {
+        if (scheduled_ == 0) {
+          current_ = target;
+          break;
+        }
+        // jump to the next occupied bottom slot or the next cascade point
+        uint64_t next = (current_ | (kSlots - 1)) + 1;
+        for (uint64_t t = current_ + 1; t < next; ++t) {
+          if (!empty(slot(0, t))) {
+            next = t;
+            break;
+          }
+        }
+        if (next > target) {
+          current_ = target;
+          break;
+        }
+        current_ = next;
+        if ((current_ & (kSlots - 1)) == 0) {
+          cascade(1);
+        }
+        expireSlot(slot(0, current_), onExpired);
+      }
+    }
+    void clear() {
+      resetSlots();
+      scheduled_ = 0;
+    }
+
+   private:
+    enum : uint64_t { kLevels = 4, kSlotBits = 6, kSlots = 64 };
+
+    impl(const impl&) = delete;
+    impl& operator=(const impl&) = delete;
+
+    uint64_t tickOf(time_point t) const {
+      return static_cast<uint64_t>(
+          std::chrono::duration_cast<std::chrono::milliseconds>(t - epoch_)
+              .count());
+    }
+    detail::WheelLink* slot(unsigned level, uint64_t tick) {
+      return &wheel_[level][(tick >> (level * kSlotBits)) & (kSlots - 1)];
+    }
+    static bool empty(const detail::WheelLink* head) {
+      return head->next == head;
+    }
+    void resetSlots() {
+      for (auto& level : wheel_) {
+        for (auto& head : level) {
+          head.prev = head.next = &head;
+        }
+      }
+    }
+    // level L holds entries due in [64^L, 64^(L+1)) ticks, anything further
+    // out waits in the top level and is re-placed when it cascades
+    void place(node_type& n) {
+      const uint64_t delta = n.expireTick > current_ ? n.expireTick - current_ : 0;
+      unsigned level = 0;
+      while (level + 1 < kLevels && delta >= (uint64_t(1) << ((level + 1) * kSlotBits))) {
+        ++level;
+      }
+      const uint64_t span = uint64_t(1) << (kLevels * kSlotBits);
+      const uint64_t tick =
+          delta < span ? std::max(n.expireTick, current_) : current_ + span - 1;
+      n.linkAfter(slot(level, tick));
+    }
+    // takes a slot's entries out so they can be re-placed safely
+    void detach(detail::WheelLink* head, detail::WheelLink& out) {
+      out.prev = out.next = &out;
+      if (!empty(head)) {
+        out.next = head->next;
+        out.prev = head->prev;
+        out.next->prev = &out;
+        out.prev->next = &out;
+        head->prev = head->next = head;
+      }
+    }
+    void cascade(unsigned level) {
+      if (level >= kLevels) {
+        return;
+      }
+      if (((current_ >> (level * kSlotBits)) & (kSlots - 1)) == 0) {
+        cascade(level + 1);
+      }
+      detail::WheelLink pending;
+      detach(slot(level, current_), pending);
+      while (!empty(&pending)) {
+        detail::WheelLink* l = pending.next;
+        l->unlink();
+        place(static_cast<node_type&>(*l));
+      }
+    }
+    template <class F>
+    void expireSlot(detail::WheelLink* head, F& onExpired) {
+      detail::WheelLink pending;
+      detach(head, pending);
+      while (!empty(&pending)) {
+        detail::WheelLink* l = pending.next;
+        l->unlink();
+        node_type& n = static_cast<node_type&>(*l);
+        if (expired(n)) {
+          --scheduled_;
+          onExpired(n);
+        } else {
+          n.expireTick = current_ + 1;
+          place(n);
+        }
+      }
+    }
+
+    duration defaultTtl_;
+    duration refreshAfter_;
+    time_point epoch_;
+    uint64_t current_;
+    size_t scheduled_;
+    detail::WheelLink wheel_[kLevels][kSlots];
+  };
+};
+
+/**
+ *	A point in time copy of a cache's statistics. All counters are monotonic
+ *totals since construction (Prometheus counters). visit(f) calls
+ *f(name, value) for each of them, e.g. to export them.
+ */
+struct StatsSnapshot {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t inserts;
+  uint64_t updates;
+  uint64_t evictions;    // removed for maxSize / maxWeight
+  uint64_t expirations;  // removed when their time to live ran out
+  uint64_t removals;     // removed by remove() / clear()
+  uint64_t pruneRuns;    // prune() calls that evicted, evictions / pruneRuns
+                         // is the average prune batch
+  uint64_t lockWaits;    // lock acquisitions that had to wait
+  uint64_t lockWaitNanos;
+
+  StatsSnapshot()
+      : hits(0),
+        misses(0),
+        inserts(0),
+        updates(0),
+        evictions(0),
+        expirations(0),
+        removals(0),
+        pruneRuns(0),
+        lockWaits(0),
+        lockWaitNanos(0) {}
+
+  double hitRatio() const {
+    const uint64_t lookups = hits + misses;
+    return lookups == 0 ? 0.0 : static_cast<double>(hits) / lookups;
+  }
+  StatsSnapshot& operator+=(const StatsSnapshot& o) {
+    hits += o.hits;
+    misses += o.misses;
+    inserts += o.inserts;
+    updates += o.updates;
+    evictions += o.evictions;
+    expirations += o.expirations;
+    removals += o.removals;
+    pruneRuns += o.pruneRuns;
+    lockWaits += o.lockWaits;
+    lockWaitNanos += o.lockWaitNanos;
+    return *this;
+  }
+  template <class F>
+  void visit(F&& f) const {
+    f("hits", hits);
+    f("misses", misses);
+    f("inserts", inserts);
+    f("updates", updates);
+    f("evictions", evictions);
+    f("expirations", expirations);
+    f("removals", removals);
+    f("prune_runs", pruneRuns);
+    f("lock_waits", lockWaits);
+    f("lock_wait_ns", lockWaitNanos);
+  }
+};
+
+/**
+ *	the default stats: nothing is counted and getStats() returns zeros
+ */
+struct NoStats {
+  template <class L>
+  struct lock {
+    typedef L type;
+  };
+  void hit() {}
+  void miss(size_t = 1) {}
+  void insert() {}
+  void update() {}
+  void removed(RemovalCause, size_t = 1) {}
+  void pruned(size_t) {}
+  StatsSnapshot snapshot() const { return StatsSnapshot(); }
+};
+
+namespace detail {
+/*
+ * wraps a lock to time the acquisitions that have to wait. the lock is
+ * tried first, so an uncontended acquisition reads no clock
+ */
+template <class L>
+class TimedLock {
+ public:
+  TimedLock() : waits_(0), waitNanos_(0) {}
+  void lock() {
+    if (!lock_.try_lock()) {
+      const auto start = std::chrono::steady_clock::now();
+      lock_.lock();
+      waited(start);
+    }
+  }
+  bool try_lock() { return lock_.try_lock(); }
+  void unlock() { lock_.unlock(); }
+  template <class M = L>
+  auto lock_shared() -> decltype(std::declval<M&>().lock_shared(), void()) {
+    if (!lock_.try_lock_shared()) {
+      const auto start = std::chrono::steady_clock::now();
+      lock_.lock_shared();
+      waited(start);
+    }
+  }
+  template <class M = L>
+  auto unlock_shared()
+      -> decltype(std::declval<M&>().unlock_shared(), void()) {
+    lock_.unlock_shared();
+  }
+  void addTo(StatsSnapshot& s) const {
+    s.lockWaits += waits_.load(std::memory_order_relaxed);
+    s.lockWaitNanos += waitNanos_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  void waited(std::chrono::steady_clock::time_point start) {
+    waits_.fetch_add(1, std::memory_order_relaxed);
+    waitNanos_.fetch_add(
+        static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start)
+                .count()),
+        std::memory_order_relaxed);
+  }
+
+  L lock_;
+  std::atomic<uint64_t> waits_;
+  std::atomic<uint64_t> waitNanos_;
+};
+template <class L>
+void addLockWaits(const L&, StatsSnapshot&) {}
+template <class L>
+void addLockWaits(const TimedLock<L>& l, StatsSnapshot& s) {
+  l.addTo(s);
+}
+}  // namespace detail
+
+/**
+ *	AtomicStats counts hits, misses, inserts, updates and removals in
+ *relaxed atomics striped per thread (each stripe on its own cache lines,
+ *like BufferedLRUPolicy's read buffers), so counting under a shared read
+ *lock doesn't make threads fight over one counter. getStats() sums the
+ *stripes.
+ *
+ *	With TimeLockWaits = true the cache lock is wrapped to also count the
+ *contended acquisitions and the time spent waiting for them.
+ */
+template <bool TimeLockWaits = false>
+struct AtomicStats {
+  template <class L>
+  struct lock {
+    typedef typename std::conditional<TimeLockWaits, detail::TimedLock<L>,
+                                      L>::type type;
+  };
+  AtomicStats() {
+    for (auto& s : stripes_) {
+      for (auto& c : s.counters) {
+        c.store(0, std::memory_order_relaxed);
+      }
+    }
+  }
+  void hit() { add(kHits, 1); }
+  void miss(size_t n = 1) { add(kMisses, n); }
+  void insert() { add(kInserts, 1); }
+  void update() { add(kUpdates, 1); }
+  void removed(RemovalCause cause, size_t n = 1) {
+    switch (cause) {
+      case RemovalCause::kSize:
+        add(kEvictions, n);
+        break;
+      case RemovalCause::kExpired:
+        add(kExpirations, n);
+        break;
+      case RemovalCause::kExplicit:
+        add(kRemovals, n);
+        break;
+      case RemovalCause::kReplaced:
+        break;
+    }
+  }
+  void pruned(size_t) { add(kPruneRuns, 1); }
+  StatsSnapshot snapshot() const {
+    StatsSnapshot r;
+    r.hits = sum(kHits);
+    r.misses = sum(kMisses);
+    r.inserts = sum(kInserts);
+    r.updates = sum(kUpdates);
+    r.evictions = sum(kEvictions);
+    r.expirations = sum(kExpirations);
+    r.removals = sum(kRemovals);
+    r.pruneRuns = sum(kPruneRuns);
+    return r;
+  }
+
+ private:
+  enum : size_t {
+    kHits,
+    kMisses,
+    kInserts,
+    kUpdates,
+    kEvictions,
+    kExpirations,
+    kRemovals,
+    kPruneRuns,
+    kCounters,
+    kStripes = 8
+  };
+  struct Stripe {
+    std::atomic<uint64_t> counters[kCounters];
+    char pad[64];
+  };
+
+  AtomicStats(const AtomicStats&) = delete;
+  AtomicStats& operator=(const AtomicStats&) = delete;
+
+  void add(size_t counter, size_t n) {
+    stripes_[detail::threadStripe() & (kStripes - 1)].counters[counter]
+        .fetch_add(n, std::memory_order_relaxed);
+  }
+  uint64_t sum(size_t counter) const {
+    uint64_t total = 0;
+    for (const auto& s : stripes_) {
+      total += s.counters[counter].load(std::memory_order_relaxed);
+    }
+    return total;
+  }
+
+  Stripe stripes_[kStripes];
+};
+
+/**
+ * error raised by saveSnapshot() / loadSnapshot() for unreadable,
+ * unwritable or malformed snapshot files
+ */
+class SnapshotError : public std::runtime_error {
+ public:
+  explicit SnapshotError(const std::string& what) : std::runtime_error(what) {}
+};
+
+namespace detail {
+/*
+ * how SnapshotSerializer encodes one key or value: the raw bytes of a
+ * trivially copyable type, the characters of a std::string
+ */
+template <class T, class = void>
+struct SnapshotCodec;
+template <class T>
+struct SnapshotCodec<
+    T, typename std::enable_if<std::is_trivially_copyable<T>::value>::type> {
+  static void write(const T& v, std::string& out) {
+    out.append(reinterpret_cast<const char*>(&v), sizeof(T));
+  }
+  static T read(const char* p, size_t n) {
+    if (n != sizeof(T)) {
+      throw SnapshotError("snapshot_bad_record");
+    }
+    T v;
+    std::memcpy(&v, p, sizeof(T));
+    return v;
+  }
+};
+template <class C, class Tr, class A>
+struct SnapshotCodec<std::basic_string<C, Tr, A>> {
+  typedef std::basic_string<C, Tr, A> string_type;
+  static void write(const string_type& v, std::string& out) {
+    out.append(reinterpret_cast<const char*>(v.data()), v.size() * sizeof(C));
+  }
+  static string_type read(const char* p, size_t n) {
+    if (n % sizeof(C) != 0) {
+      throw SnapshotError("snapshot_bad_record");
+    }
+    string_type v(n / sizeof(C), C());
+    std::memcpy(&v[0], p, n);
+    return v;
+  }
+};
+}  // namespace detail
+
+/**
+ * the default serializer of saveSnapshot() / loadSnapshot(), for trivially
+ * copyable keys and values and std::string. any other type needs a
+ * serializer with the same four members: writeKey / writeValue append the
+ * encoded bytes to out, readKey / readValue decode n bytes at p (and throw
+ * on malformed input)
+ */
+template <class Key, class Value>
+struct SnapshotSerializer {
+  void writeKey(const Key& k, std::string& out) const {
+    detail::SnapshotCodec<Key>::write(k, out);
+  }
+  void writeValue(const Value& v, std::string& out) const {
+    detail::SnapshotCodec<Value>::write(v, out);
+  }
+  Key readKey(const char* p, size_t n) const {
+    return detail::SnapshotCodec<Key>::read(p, n);
+  }
+  Value readValue(const char* p, size_t n) const {
+    return detail::SnapshotCodec<Value>::read(p, n);
+  }
+};
+
+namespace detail {
+/*
+ * snapshot file layout, in native byte order (snapshots are meant for
+ * restarts on the same platform):
+ *	"LRU11SN1", uint64 entry count, then per entry a varint key size, the
+ *	key bytes, a varint value size and the value bytes, MRU entry first
+ */
+static const char kSnapshotMagic[8] = {'L', 'R', 'U', '1', '1', 'S', 'N', '1'};
+static const size_t kSnapshotHeader = sizeof(kSnapshotMagic) + sizeof(uint64_t);
+
+inline void putVarint(std::string& out, uint64_t v) {
+  while (v >= 0x80) {
+    out.push_back(static_cast<char>((v & 0x7f) | 0x80));
+    v >>= 7;
+  }
+  out.push_back(static_cast<char>(v));
+}
+inline uint64_t getVarint(const char*& p, const char* end) {
+  uint64_t v = 0;
+  for (unsigned shift = 0; p != end && shift < 64; shift += 7) {
+    const uint8_t b = static_cast<uint8_t>(*p++);
+    v |= static_cast<uint64_t>(b & 0x7f) << shift;
+    if ((b & 0x80) == 0) {
+      return v;
+    }
+  }
+  throw SnapshotError("snapshot_truncated");
+}
+
+// appends one entry, scratch is only reused to avoid allocations
+template <class Serializer, class Key, class Value>
+void putSnapshotRecord(std::string& out, std::string& scratch,
+                       const Serializer& s, const Key& k, const Value& v) {
+  scratch.clear();
+  s.writeKey(k, scratch);
+  putVarint(out, scratch.size());
+  out += scratch;
+  scratch.clear();
+  s.writeValue(v, scratch);
+  putVarint(out, scratch.size());
+  out += scratch;
+}
+
+// writes header + body to path.tmp and renames it over path, so a crash
+// never leaves a half written snapshot behind
+inline void writeSnapshotFile(const std::string& path, const std::string& body,
+                              uint64_t count) {
+  const std::string tmp = path + ".tmp";
+  FILE* f = std::fopen(tmp.c_str(), "wb");
+  if (f == nullptr) {
+    throw SnapshotError("snapshot_open_failed");
+  }
+  const bool ok = std::fwrite(kSnapshotMagic, sizeof(kSnapshotMagic), 1, f) == 1 &&
+                  std::fwrite(&count, sizeof(count), 1, f) == 1 &&
+                  (body.empty() ||
+                   std::fwrite(body.data(), body.size(), 1, f) == 1);
+  if (std::fclose(f) != 0 || !ok) {
+    std::remove(tmp.c_str());
+    throw SnapshotError("snapshot_write_failed");
+  }
+  if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+    std::remove(tmp.c_str());
+    throw SnapshotError("snapshot_write_failed");
+  }
+}
+
+/*
+ * a read only view of a whole file: memory-mapped where the platform allows
+ * (so a multi-GB snapshot is paged in as it is decoded), read in otherwise
+ */
+class MappedFile {
+ public:
+  explicit MappedFile(const std::string& path) : data_(nullptr), size_(0) {
+#ifdef LRU11_HAVE_MMAP
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw SnapshotError("snapshot_open_failed");
+    }
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+      size_ = static_cast<size_t>(st.st_size);
+      void* p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p != MAP_FAILED) {
+        ::madvise(p, size_, MADV_SEQUENTIAL);
+        data_ = static_cast<const char*>(p);
+      }
+    }
+    ::close(fd);
+    if (data_ != nullptr || size_ == 0) {
+      return;
+    }
+#endif
+    FILE* f = std::fopen(path.c_str(), "rb");
+    if (f == nullptr) {
+      throw SnapshotError("snapshot_open_failed");
+    }
+    char buf[1 << 16];
+    size_t n;
+    while ((n = std::fread(buf, 1, sizeof(buf), f)) != 0) {
+      copy_.insert(copy_.end(), buf, buf + n);
+    }
+    std::fclose(f);
+    size_ = copy_.size();
+  }
+  ~MappedFile() {
+#ifdef LRU11_HAVE_MMAP
+    if (data_ != nullptr) {
+      ::munmap(const_cast<char*>(data_), size_);
+    }
+#endif
+  }
+  const char* begin() const { return data_ ? data_ : copy_.data(); }
+  const char* end() const { return begin() + size_; }
+
+ private:
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const char* data_;
+  size_t size_;
+  std::vector<char> copy_;
+};
+
+struct SnapshotRecord {
+  const char* key;
+  size_t keySize;
+  const char* value;
+  size_t valueSize;
+};
+// validates a mapped snapshot and indexes its entries, MRU first
+inline std::vector<SnapshotRecord> parseSnapshot(const MappedFile& f) {
+  const char* p = f.begin();
+  const char* const end = f.end();
+  uint64_t count = 0;
+  if (static_cast<size_t>(end - p) < kSnapshotHeader ||
+      std::memcmp(p, kSnapshotMagic, sizeof(kSnapshotMagic)) != 0) {
+    throw SnapshotError("snapshot_bad_header");
+  }
+  std::memcpy(&count, p + sizeof(kSnapshotMagic), sizeof(count));
+  p += kSnapshotHeader;
+  // every entry takes at least two bytes, so count cannot be absurd
+  if (count > static_cast<uint64_t>(end - p) / 2) {
+    throw SnapshotError("snapshot_truncated");
+  }
+  std::vector<SnapshotRecord> records(static_cast<size_t>(count));
+  for (auto& r : records) {
+    r.keySize = static_cast<size_t>(getVarint(p, end));
+    if (r.keySize > static_cast<size_t>(end - p)) {
+      throw SnapshotError("snapshot_truncated");
+    }
+    r.key = p;
+    p += r.keySize;
+    r.valueSize = static_cast<size_t>(getVarint(p, end));
+    if (r.valueSize > static_cast<size_t>(end - p)) {
+      throw SnapshotError("snapshot_truncated");
+    }
+    r.value = p;
+    p += r.valueSize;
+  }
+  return records;
+}
+
+// pre-sizes maps that support it (std::unordered_map), a noop otherwise
+template <class M>
+auto reserveMap(M& m, size_t n, int) -> decltype(m.reserve(n), void()) {
+  m.reserve(n);
+}
+template <class M>
+void reserveMap(M&, size_t, long) {}
+}  // namespace detail
+
+/**
+ *	Policies bundles the optional features of a Cache / ShardedCache so they
+ *can be named instead of passed by position:
+ *
+ *		Cache<K, V, Policies<UseLock<std::mutex>, UseExpiry<TimedExpiry<>>>>
+ *
+ *	is Cache<K, V, std::mutex, <default map>, LRUPolicy, NoWeigher,
+ *TimedExpiry<>, NoStats>. A feature that is left out is off (NullLock,
+ *LRUPolicy, NoWeigher, NoExpiry, NoStats, std::allocator), and off features are free: they
+ *add no bytes to the node (checked by the static_asserts in Cache) and their
+ *hooks are empty inline functions, so the hot path only pays for what the
+ *bundle turns on.
+ */
+template <class... Features>
+struct Policies {};
+template <class L>
+struct UseLock {};
+template <class M>
+struct UseMap {};
+// the shard hash of a ShardedCache
+template <class H>
+struct UseHash {};
+template <class P>
+struct UseEviction {};
+template <class W>
+struct UseWeigher {};
+template <class E>
+struct UseExpiry {};
+template <class S>
+struct UseStats {};
+template <class A>
+struct UseAllocator {};
+
+namespace detail {
+// the argument of the first Tag<T> in Fs, Default if there is none
+template <template <class> class Tag, class Default, class... Fs>
+struct PickFeature {
+  typedef Default type;
+};
+template <template <class> class Tag, class Default, class T, class... Fs>
+struct PickFeature<Tag, Default, Tag<T>, Fs...> {
+  typedef T type;
+};
+template <template <class> class Tag, class Default, class F, class... Fs>
+struct PickFeature<Tag, Default, F, Fs...> : PickFeature<Tag, Default, Fs...> {
+};
+
+template <class F>
+struct is_feature : std::false_type {};
+template <class T>
+struct is_feature<UseLock<T>> : std::true_type {};
+template <class T>
+struct is_feature<UseMap<T>> : std::true_type {};
+template <class T>
+struct is_feature<UseHash<T>> : std::true_type {};
+template <class T>
+struct is_feature<UseEviction<T>> : std::true_type {};
+template <class T>
+struct is_feature<UseWeigher<T>> : std::true_type {};
+template <class T>
+struct is_feature<UseExpiry<T>> : std::true_type {};
+template <class T>
+struct is_feature<UseStats<T>> : std::true_type {};
+template <class T>
+struct is_feature<UseAllocator<T>> : std::true_type {};
+template <class... Fs>
+struct all_features : std::true_type {};
+template <class F, class... Fs>
+struct all_features<F, Fs...>
+    : std::integral_constant<bool, is_feature<F>::value &&
+                                       all_features<Fs...>::value> {};
+
+// the positional template arguments a Policies bundle stands for
+template <class Key, class Value, class... Fs>
+struct PolicyBundle {
+  static_assert(all_features<Fs...>::value,
+                "Policies<> only takes UseLock<>, UseMap<>, UseHash<>, "
+                "UseEviction<>, UseWeigher<>, UseExpiry<>, UseStats<> and "
+                "UseAllocator<>");
+  typedef typename PickFeature<UseLock, NullLock, Fs...>::type lock;
+  typedef typename PickFeature<
+      UseMap,
+      std::unordered_map<
+          Key, typename std::list<KeyValuePair<Key, Value>>::iterator>,
+      Fs...>::type map;
+  typedef typename PickFeature<UseHash, std::hash<Key>, Fs...>::type hash;
+  typedef typename PickFeature<UseEviction, LRUPolicy, Fs...>::type policy;
+  typedef typename PickFeature<UseWeigher, NoWeigher, Fs...>::type weigher;
+  typedef typename PickFeature<UseExpiry, NoExpiry, Fs...>::type expiry;
+  typedef typename PickFeature<UseStats, NoStats, Fs...>::type stats;
+  typedef typename PickFeature<UseAllocator, std::allocator<char>,
+                               Fs...>::type allocator;
+};
+
+// reference layouts for the node size checks in Cache: the key and value
+// alone, and with the one byte flag ClockPolicy and TinyLFUPolicy add
+template <class K, class V>
+struct PlainPair {
+  K key;
+  V value;
+};
+template <class K, class V>
+struct FlaggedPair {
+  K key;
+  V value;
+  uint8_t flag;
+};
+}  // namespace detail
+
+/**
+ *	The LRU Cache class templated by
+ *		Key - key type
+ *		Value - value type
+ *		MapType - an associative container like std::unordered_map
+ *		LockType - a lock type derived from the Lock class (default:
+ *NullLock = no synchronization)
+ *		Policy - the eviction policy (default: LRUPolicy)
+ *		Weigher - size_t operator()(const Key&, const Value&) giving the
+ *weight (e.g. bytes) of an entry, see maxWeight (default: NoWeigher)
+ *		Expiry - per entry time to live, NoExpiry or TimedExpiry<Clock>
+ *(default: NoExpiry)
+ *		Stats - statistics, NoStats or AtomicStats<> (default: NoStats)
+ *		Allocator - allocates the list nodes and (for std maps) the map
+ *nodes, e.g. std::pmr::polymorphic_allocator<char> (default: std::allocator)
+ *
+ *	or Cache<Key, Value, Policies<...>> to name just the features in use, see
+ *Policies
+ *
+ *	The default NullLock based template is not thread-safe, however passing
+ *Lock=std::mutex will make it
+ *	thread-safe
+ */
+template <class Key, class Value, class Lock = NullLock,
+          class Map = std::unordered_map<
+              Key, typename std::list<KeyValuePair<Key, Value>>::iterator>,
+          class Policy = LRUPolicy, class Weigher = NoWeigher,
+          class Expiry = NoExpiry, class Stats = NoStats,
+          class Allocator = std::allocator<char>>
+class Cache {
+  // the default allocator leaves the allocator of the Map alone
+  typedef typename std::conditional<
+      std::is_same<Allocator, std::allocator<char>>::value, void,
+      Allocator>::type map_allocator;
+
+ public:
+  typedef typename Expiry::template node<
+      typename Policy::template node<Key, Value>::type>::type node_type;
+  typedef Key key_type;
+  typedef Value mapped_type;
+  typedef Allocator allocator_type;
+  typedef std::list<node_type,
+                    typename std::allocator_traits<
+                        Allocator>::template rebind_alloc<node_type>>
+      list_type;
+  typedef detail::RebindMap<Map, typename list_type::iterator, map_allocator>
+      rebind_map;
+  typedef typename rebind_map::type map_type;
+  typedef Lock lock_type;
+  typedef typename Policy::template impl<list_type> policy_type;
+  typedef typename Expiry::template impl<list_type> expiry_type;
+  typedef typename expiry_type::duration duration;
+  // the lock actually held, Lock or Lock wrapped by the Stats
+  typedef typename Stats::template lock<Lock>::type guarded_lock_type;
+  using Guard = std::lock_guard<guarded_lock_type>;
+  typedef detail::Flight<Value> flight_type;
+  // called with the result of an in flight load, see beginLoad()
+  typedef std::function<void(const std::shared_future<Value>&)> LoadWaiter;
+  // features that are off must cost nothing per entry: without an Expiry
+  // the built-in policies' nodes are the key and value plus at most their
+  // one byte flag
+  static_assert(!std::is_same<Expiry, NoExpiry>::value ||
+                    !(std::is_same<Policy, LRUPolicy>::value ||
+                      std::is_same<Policy, BufferedLRUPolicy>::value) ||
+                    sizeof(node_type) == sizeof(detail::PlainPair<Key, Value>),
+                "an LRU node without expiry is just the key and value");
+  static_assert(!std::is_same<Expiry, NoExpiry>::value ||
+                    !(std::is_same<Policy, ClockPolicy>::value ||
+                      std::is_same<Policy, TinyLFUPolicy>::value) ||
+                    sizeof(node_type) <=
+                        sizeof(detail::FlaggedPair<Key, Value>),
+                "a CLOCK / TinyLFU node without expiry is the key, the value "
+                "and a flag");
+  static_assert(!std::is_same<Stats, NoStats>::value ||
+                    (std::is_empty<Stats>::value &&
+                     std::is_same<guarded_lock_type, Lock>::value),
+                "NoStats must not take space or wrap the lock");
+  // guard for the get paths: shared if the policy and the lock allow it
+  using ReadGuard = typename std::conditional<
+      policy_type::kSharedReads, detail::SharedGuard<guarded_lock_type>,
+      Guard>::type;
+  // guard for the read-only probes (contains, peek, size, cwalk): shared
+  // whenever the lock allows it, whatever the policy, as they never touch
+  // the recency state
+  using ProbeGuard = detail::SharedGuard<guarded_lock_type>;
+  // enables the heterogeneous lookup overloads for non-Key lookup types
+  template <class K>
+  using EnableTransparent = typename std::enable_if<
+      detail::is_transparent_map<map_type>::value &&
+      !std::is_same<typename std::decay<K>::type, Key>::value>::type;
+  /**
+   * the maxSize is the soft limit of keys and (maxSize + elasticity) is the
+   * hard limit
+   * the cache is allowed to grow till (maxSize + elasticity) and is pruned back
+   * to maxSize keys
+   * set maxSize = 0 for an unbounded cache (but in that case, you're better off
+   * using a std::unordered_map
+   * directly anyway! :)
+   *
+   * maxWeight is a hard limit on the total weight (as computed by the
+   * Weigher) of all entries, 0 = no weight limit. an entry heavier than
+   * maxWeight on its own is not cached at all. the weigher must return the
+   * same weight for an entry for as long as it is cached
+   */
+  explicit Cache(size_t maxSize = 64, size_t elasticity = 10,
+                 size_t maxWeight = 0, const Weigher& weigher = Weigher(),
+                 const Allocator& alloc = Allocator())
+      : cache_(detail::makeContainer<map_type>(
+            alloc, std::integral_constant<bool, rebind_map::kRebound>())),
+        keys_(typename list_type::allocator_type(alloc)),
+        maxSize_(maxSize),
+        elasticity_(elasticity),
+        maxWeight_(maxWeight),
+        weight_(0),
+        weigher_(weigher),
+        pruneBudget_(0),
+        draining_(false),
+        removed_(nullptr) {
+    policy_.init(keys_, maxSize_, elasticity_);
+  }
+  virtual ~Cache() = default;
+  size_t size() const {
+    ProbeGuard g(lock_);
+    return cache_.size();
+  }
+  bool empty() const {
+    ProbeGuard g(lock_);
+    return cache_.empty();
+  }
+  void clear() {
+    WriteGuard g(*this);
+    policy_.clear(keys_);
+    expiry_.clear();
+    cache_.clear();
+    stats_.removed(RemovalCause::kExplicit, keys_.size());
+    if (removed_ != nullptr) {
+      removed_->take(keys_, keys_.begin(), keys_.end(),
+                     RemovalCause::kExplicit);
+    }
+    keys_.clear();
+    weight_ = 0;
+  }
+  void insert(const Key& k, Value v) {
+    WriteGuard g(*this);
+    insert_nolock(k, std::move(v), expiry_.defaultTtl());
+  }
+  void insert(Key&& k, Value&& v) {
+    WriteGuard g(*this);
+    insert_nolock(std::move(k), std::move(v), expiry_.defaultTtl());
+  }
+  /**
+   * insert with a per entry time to live (needs Expiry = TimedExpiry<>),
+   * zero = never expire
+   */
+  void insert(const Key& k, Value v, duration ttl) {
+    static_assert(expiry_type::kEnabled, "per entry ttl needs an Expiry");
+    WriteGuard g(*this);
+    insert_nolock(k, std::move(v), ttl);
+  }
+  void insert(Key&& k, Value&& v, duration ttl) {
+    static_assert(expiry_type::kEnabled, "per entry ttl needs an Expiry");
+    WriteGuard g(*this);
+    insert_nolock(std::move(k), std::move(v), ttl);
+  }
+  /**
+   * same as insert(), but returns true if k was added and false if an
+   * existing entry was overwritten (or the entry was too heavy to keep)
+   */
+  bool insert_or_assign(const Key& k, Value v) {
+    WriteGuard g(*this);
+    return insert_nolock(k, std::move(v), expiry_.defaultTtl());
+  }
+  bool insert_or_assign(Key&& k, Value&& v) {
+    WriteGuard g(*this);
+    return insert_nolock(std::move(k), std::move(v), expiry_.defaultTtl());
+  }
+  /**
+   * constructs the value for k in place from args, if k is not cached yet.
+   * an existing entry is left untouched. returns true if k was added
+   */
+  template <class... Args>
+  bool emplace(const Key& k, Args&&... args) {
+    WriteGuard g(*this);
+    return emplace_nolock(k, std::forward<Args>(args)...);
+  }
+  template <class... Args>
+  bool emplace(Key&& k, Args&&... args) {
+    WriteGuard g(*this);
+    return emplace_nolock(std::move(k), std::forward<Args>(args)...);
+  }
+  /**
+   * the ttl used by insert(k, v), zero (the default) = never expire
+   */
+  void setDefaultTtl(duration ttl) {
+    static_assert(expiry_type::kEnabled, "default ttl needs an Expiry");
+    Guard g(lock_);
+    expiry_.setDefaultTtl(ttl);
+  }
+  duration getDefaultTtl() const {
+    Guard g(lock_);
+    return expiry_.defaultTtl();
+  }
+  /**
+   * refresh ahead: a hit on an entry written more than refreshAfter ago
+   * still returns the current value, but also hands a reload task to
+   * executor (called without the lock held). the task calls loader(key)
+   * and swaps the new value in with the default ttl. set this up before
+   * the cache is shared, and keep the cache alive until the executor has
+   * run every task. zero turns refreshing off
+   */
+  void setRefresh(duration refreshAfter,
+                  std::function<Value(const Key&)> loader,
+                  std::function<void(std::function<void()>)> executor) {
+    static_assert(expiry_type::kEnabled, "refresh needs an Expiry");
+    Guard g(lock_);
+    refreshLoader_ = std::move(loader);
+    refreshExecutor_ = std::move(executor);
+    expiry_.setRefreshAfter(refreshAfter);
+  }
+  /**
+   * listener(key, value, cause) is called for every entry that leaves the
+   * cache (see RemovalCause). removals are batched per call and delivered
+   * after the lock is released, so the listener may call back into the
+   * cache, and it may move the value out. set it before the cache is
+   * shared. the listener must not throw
+   */
+  void setRemovalListener(
+      std::function<void(const Key&, Value&, RemovalCause)> listener) {
+    Guard g(lock_);
+    listener_ = std::move(listener);
+  }
+  /**
+    for backward compatibity. redirects to tryGetCopy()
+   */
+  bool tryGet(const Key& kIn, Value& vOut) {
+    return tryGetCopy(kIn, vOut);
+  }
+
+  bool tryGetCopy(const Key& kIn, Value& vOut) {
+    syncIfPending();
+    RefreshTicket t(*this);
+    ReadGuard g(lock_);
+    return tryGetRef_nolock(kIn, vOut, t);
+  }
+  
+  bool tryGetRef(const Key& kIn, Value& vOut) {
+    syncIfPending();
+    RefreshTicket t(*this);
+    ReadGuard g(lock_);
+    return tryGetRef_nolock(kIn, vOut, t);
+  }
+  /**
+   *	The const reference returned here is only
+   *    guaranteed to be valid till the next insert/delete
+   *  in multi-threaded apps use getCopy() to be threadsafe (or store
+   *  handles, see SharedValueCache, to make getCopy() cheap)
+   */
+  const Value& getRef(const Key& k) {
+    syncIfPending();
+    RefreshTicket t(*this);
+    ReadGuard g(lock_);
+    return get_nolock(k, t);
+  }
+
+  /**
+      added for backward compatibility
+   */
+  Value get(const Key& k) {
+    return getCopy(k);
+  }
+  /**
+   * returns a copy of the stored object (if found)
+   * safe to use/recommended in multi-threaded apps
+   */
+  Value getCopy(const Key& k) {
+    syncIfPending();
+    RefreshTicket t(*this);
+    ReadGuard g(lock_);
+    return get_nolock(k, t);
+  }
+
+  bool remove(const Key& k) {
+    WriteGuard g(*this);
+    return remove_nolock(k);
+  }
+  /**
+   * removes every key in [lo, hi) and returns how many there were: one map
+   * descent, then only the entries in the range are touched. needs an
+   * ordered Map (std::map, lru11::BTreeMap). the removal listener sees
+   * RemovalCause::kExplicit
+   */
+  size_t removeRange(const Key& lo, const Key& hi) {
+    static_assert(detail::is_ordered_map<map_type>::value,
+                  "removeRange() needs an ordered Map");
+    WriteGuard g(*this);
+    const auto less = cache_.key_comp();
+    return removeSpan_nolock(
+        lo, [&less, &hi](const Key& k) { return less(k, hi); });
+  }
+  /**
+   * removes every key that starts with prefix (keys that are sequences,
+   * e.g. std::string or std::vector, under the default lexicographic
+   * compare, which keeps such keys adjacent). see removeRange()
+   */
+  size_t removePrefix(const Key& prefix) {
+    static_assert(detail::is_ordered_map<map_type>::value,
+                  "removePrefix() needs an ordered Map");
+    WriteGuard g(*this);
+    return removeSpan_nolock(prefix, [&prefix](const Key& k) {
+      return detail::hasPrefix(k, prefix);
+    });
+  }
+  bool contains(const Key& k) const {
+    ProbeGuard g(lock_);
+    return contains_nolock(k);
+  }
+  /**
+   * reads a value without promoting it: the recency order, the policy
+   * state, the stats and any refresh-ahead are left alone, so admin / health
+   * check probes do not skew the cache. peek() throws KeyNotFound.
+   * const and under a shared lock where the lock type supports one
+   */
+  bool tryPeek(const Key& kIn, Value& vOut) const {
+    ProbeGuard g(lock_);
+    return tryPeek_nolock(kIn, vOut);
+  }
+  Value peek(const Key& k) const {
+    ProbeGuard g(lock_);
+    return peek_nolock(k);
+  }
+
+  /**
+   *	heterogeneous lookups: with a transparent Map (e.g. std::map<K, V,
+   *std::less<>> or, in C++20, std::unordered_map with a transparent hash and
+   *key_equal) these take anything the map can compare with a Key, e.g. a
+   *std::string_view for std::string keys, without building a temporary Key
+   */
+  template <class K, class = EnableTransparent<K>>
+  bool tryGet(const K& kIn, Value& vOut) {
+    return tryGetCopy(kIn, vOut);
+  }
+  template <class K, class = EnableTransparent<K>>
+  bool tryGetCopy(const K& kIn, Value& vOut) {
+    syncIfPending();
+    RefreshTicket t(*this);
+    ReadGuard g(lock_);
+    return tryGetRef_nolock(kIn, vOut, t);
+  }
+  template <class K, class = EnableTransparent<K>>
+  bool tryGetRef(const K& kIn, Value& vOut) {
+    syncIfPending();
+    RefreshTicket t(*this);
+    ReadGuard g(lock_);
+    return tryGetRef_nolock(kIn, vOut, t);
+  }
+  template <class K, class = EnableTransparent<K>>
+  const Value& getRef(const K& k) {
+    syncIfPending();
+    RefreshTicket t(*this);
+    ReadGuard g(lock_);
+    return get_nolock(k, t);
+  }
+  template <class K, class = EnableTransparent<K>>
+  Value get(const K& k) {
+    return getCopy(k);
+  }
+  template <class K, class = EnableTransparent<K>>
+  Value getCopy(const K& k) {
+    syncIfPending();
+    RefreshTicket t(*this);
+    ReadGuard g(lock_);
+    return get_nolock(k, t);
+  }
+  template <class K, class = EnableTransparent<K>>
+  bool remove(const K& k) {
+    WriteGuard g(*this);
+    return remove_nolock(k);
+  }
+  template <class K, class = EnableTransparent<K>>
+  bool contains(const K& k) const {
+    ProbeGuard g(lock_);
+    return contains_nolock(k);
+  }
+  template <class K, class = EnableTransparent<K>>
+  bool tryPeek(const K& kIn, Value& vOut) const {
+    ProbeGuard g(lock_);
+    return tryPeek_nolock(kIn, vOut);
+  }
+  template <class K, class = EnableTransparent<K>>
+  Value peek(const K& k) const {
+    ProbeGuard g(lock_);
+    return peek_nolock(k);
+  }
+
+  // locked, as setMaxSize() / setElasticity() can change them
+  size_t getMaxSize() const {
+    ProbeGuard g(lock_);
+    return maxSize_;
+  }
+  size_t getElasticity() const {
+    ProbeGuard g(lock_);
+    return elasticity_;
+  }
+  size_t getMaxAllowedSize() const {
+    ProbeGuard g(lock_);
+    return maxSize_ + elasticity_;
+  }
+  size_t getMaxWeight() const { return maxWeight_; }
+  /**
+   * changes the soft limit at runtime (0 = unbounded). growing takes effect
+   * at once. shrinking below size() starts a drain back to the new maxSize:
+   * without a prune budget this call evicts the excess, with one it evicts
+   * at most budget entries and the drain continues through the following
+   * inserts and maintain() calls, budget entries at a time (a budget of 1
+   * only holds the size, use 2 or more or maintain() to shrink). the cache
+   * may stay over the new hard limit until the drain gets there
+   */
+  void setMaxSize(size_t maxSize) {
+    WriteGuard g(*this);
+    maxSize_ = maxSize;
+    resize_nolock();
+  }
+  // changes the elasticity at runtime, a smaller one drains as above
+  void setElasticity(size_t elasticity) {
+    WriteGuard g(*this);
+    elasticity_ = elasticity;
+    resize_nolock();
+  }
+  /**
+   * sizes the map for n entries up front (for std::unordered_map, a no-op
+   * for std::map), so inserts do not rehash until the cache holds more than
+   * n. reserve(getMaxAllowedSize()) makes every insert rehash free
+   */
+  void reserve(size_t n) {
+    Guard g(lock_);
+    detail::reserveMap(cache_, n, 0);
+  }
+  /**
+   * bounds the eviction work of a single insert. by default (0) the insert
+   * that reaches maxSize + elasticity evicts everything over maxSize in one
+   * go. with a budget the cache still grows to the hard limit and drains
+   * back to maxSize, but each insert evicts at most budget entries while it
+   * drains (at least enough to stay under the hard limit, so a budget of 1
+   * only holds it there). the maxWeight limit is always enforced in full
+   */
+  void setPruneBudget(size_t budget) {
+    WriteGuard g(*this);
+    pruneBudget_ = budget;
+  }
+  size_t getPruneBudget() const {
+    ProbeGuard g(lock_);
+    return pruneBudget_;
+  }
+  /**
+   * the eviction work for a maintenance thread / timer: reclaims expired
+   * entries and evicts at most budget entries over maxSize, so inserts
+   * rarely reach the hard limit at all. returns the number evicted for size
+   */
+  size_t maintain(size_t budget) {
+    WriteGuard g(*this);
+    policy_.sync(keys_);
+    expire_nolock();
+    const size_t count = trim_nolock(budget);
+    if (count != 0) {
+      stats_.pruned(count);
+    }
+    return count;
+  }
+  /**
+   * checks the internal consistency, for tests and stress runs: the map and
+   * the list hold the same entries, every map entry points at the node of
+   * its key, the weights add up and the size is within the hard limit
+   * (unless a shrink is still draining). O(size()) under the exclusive lock
+   */
+  bool checkInvariants() const {
+    Guard g(lock_);
+    if (cache_.size() != keys_.size()) {
+      return false;
+    }
+    size_t weight = 0;
+    for (auto it = keys_.begin(); it != keys_.end(); ++it) {
+      const auto iter = cache_.find(it->key);
+      if (iter == cache_.end() || iter->second != it) {
+        return false;
+      }
+      weight += weigher_(it->key, it->value);
+    }
+    if (weight != weight_ || (maxWeight_ != 0 && weight_ > maxWeight_)) {
+      return false;
+    }
+    return maxSize_ == 0 || draining_ ||
+           cache_.size() <= maxSize_ + elasticity_;
+  }
+  /**
+   * the total weight of all entries (always 0 with NoWeigher)
+   */
+  size_t currentWeight() const {
+    Guard g(lock_);
+    return weight_;
+  }
+  /**
+   * a snapshot of the Stats counters (all zero with NoStats), taken
+   * without the lock
+   */
+  StatsSnapshot getStats() const {
+    StatsSnapshot s = stats_.snapshot();
+    detail::addLockWaits(lock_, s);
+    return s;
+  }
+  /**
+   * returns the value for k, calling loader(k) to compute and insert it on
+   * a miss. concurrent misses on the same key are single-flighted: one
+   * caller runs the loader (outside the lock) and the others wait for its
+   * result, or its exception, instead of loading the key again
+   */
+  template <class Loader>
+  Value getOrLoad(const Key& k, Loader&& loader) {
+    return getOrLoad_impl(k, std::forward<Loader>(loader), duration::zero(),
+                          false);
+  }
+  template <class Loader>
+  Value getOrLoad(const Key& k, Loader&& loader, duration ttl) {
+    static_assert(expiry_type::kEnabled, "per entry ttl needs an Expiry");
+    return getOrLoad_impl(k, std::forward<Loader>(loader), ttl, true);
+  }
+  /**
+   * the non blocking building blocks of getOrLoad(), for callers that load
+   * asynchronously (see LRUCache11Async.hpp). beginLoad() copies a hit to
+   * vOut (kHit), or registers onReady on the load of k already in flight
+   * (kWait), or, if claim is set, makes the caller the loader of k (kLoad),
+   * who must then call endLoad() or failLoad(). onReady runs with the
+   * load's result on the thread that ends it, after the lock is released.
+   */
+  LoadState beginLoad(const Key& k, Value& vOut, LoadWaiter onReady,
+                      bool claim = true) {
+    if (tryGetRef(k, vOut)) {
+      return LoadState::kHit;
+    }
+    Guard g(lock_);
+    const auto iter = cache_.find(k);
+    if (iter != cache_.end() && !expiry_.expired(*iter->second)) {
+      policy_.onHit(keys_, iter->second);
+      vOut = iter->second->value;
+      return LoadState::kHit;
+    }
+    const auto flight = flights_.find(k);
+    if (flight != flights_.end()) {
+      if (onReady) {
+        flight->second.waiters.push_back(std::move(onReady));
+      }
+      return LoadState::kWait;
+    }
+    if (!claim) {
+      return LoadState::kMiss;
+    }
+    flights_.emplace(std::piecewise_construct, std::forward_as_tuple(k),
+                     std::forward_as_tuple());
+    return LoadState::kLoad;
+  }
+  // inserts the loaded value and wakes everyone waiting on the load of k
+  void endLoad(const Key& k, const Value& v) {
+    endLoad_impl(k, v, expiry_.defaultTtl());
+  }
+  void endLoad(const Key& k, const Value& v, duration ttl) {
+    static_assert(expiry_type::kEnabled, "per entry ttl needs an Expiry");
+    endLoad_impl(k, v, ttl);
+  }
+  // hands e to everyone waiting on the load of k, caches nothing
+  void failLoad(const Key& k, std::exception_ptr e) {
+    flight_type f;
+    {
+      Guard g(lock_);
+      takeFlight_nolock(k, f);
+    }
+    f.done.set_exception(e);
+    wake(f);
+  }
+  /**
+   * batched lookup of keys[0..n) under one lock acquisition. every hit is
+   * copied to values[i] and sets found[i], the other values[i] are left as
+   * they were. returns the number of hits.
+   */
+  template <class Keys>
+  size_t getMany(const Keys& keys, std::vector<Value>& values,
+                 std::vector<bool>& found) {
+    values.resize(keys.size());
+    found.assign(keys.size(), false);
+    return getMany_locked(
+        keys.size(), [&keys](size_t i) -> const Key& { return keys[i]; },
+        [&values, &found](size_t i, const Value& v) {
+          values[i] = v;
+          found[i] = true;
+        });
+  }
+  /**
+   * inserts every (key, value) pair of [first, last) under one lock
+   * acquisition (pairs are moved from with std::make_move_iterator)
+   */
+  template <class It>
+  void insertMany(It first, It last) {
+    WriteGuard g(*this);
+    for (; first != last; ++first) {
+      insertOne_nolock(*first);
+    }
+  }
+  template <class Range>
+  void insertMany(const Range& items) {
+    insertMany(std::begin(items), std::end(items));
+  }
+  /**
+   * writes the live entries to path in list order (MRU -> LRU for
+   * LRUPolicy) through the serializer, see SnapshotSerializer. the entries
+   * are encoded under a shared / probe lock and written out after it is
+   * released; the file is replaced atomically. returns the entry count,
+   * throws SnapshotError if the file cannot be written
+   */
+  template <class Serializer = SnapshotSerializer<Key, Value>>
+  size_t saveSnapshot(const std::string& path,
+                      const Serializer& s = Serializer()) const {
+    std::string body;
+    const size_t count = serialize(body, s);
+    detail::writeSnapshotFile(path, body, count);
+    return count;
+  }
+  /**
+   * warm start: bulk inserts the entries of a snapshot written by
+   * saveSnapshot(), LRU first so the recency order is restored, with the
+   * map pre-reserved and the file memory-mapped. only the first maxSize
+   * records are loaded: the most recent entries of a Cache snapshot, and
+   * of a ShardedCache one (which interleaves its shards by recency rank)
+   * the most recent of every shard, in equal numbers until the smaller
+   * shards run out. they get the default ttl. meant for an empty
+   * cache, loaded entries replace cached ones. returns the number loaded,
+   * throws SnapshotError for a missing or malformed file
+   */
+  template <class Serializer = SnapshotSerializer<Key, Value>>
+  size_t loadSnapshot(const std::string& path,
+                      const Serializer& s = Serializer()) {
+    const detail::MappedFile file(path);
+    const std::vector<detail::SnapshotRecord> records =
+        detail::parseSnapshot(file);
+    WriteGuard g(*this);
+    size_t n = records.size();
+    if (maxSize_ != 0 && n > maxSize_) {
+      n = maxSize_;
+    }
+    detail::reserveMap(cache_, cache_.size() + n, 0);
+    for (size_t i = n; i-- > 0;) {
+      const detail::SnapshotRecord& r = records[i];
+      insert_nolock(s.readKey(r.key, r.keySize),
+                    s.readValue(r.value, r.valueSize), expiry_.defaultTtl());
+    }
+    return n;
+  }
+  /**
+   * walks the entries in list order (MRU -> LRU for LRUPolicy), expired
+   * entries are skipped
+   */
+  template <typename F>
+  void cwalk(F& f) const {
+    ProbeGuard g(lock_);
+    for (const auto& n : keys_) {
+      if (!expiry_.expired(n)) {
+        f(n);
+      }
+    }
+  }
+
+ protected:
+  template <class, class, class, class, class, class, class, class, class,
+            class>
+  friend class ShardedCache;
+
+  template <class Loader>
+  Value getOrLoad_impl(const Key& k, Loader&& loader, duration ttl,
+                       bool ownTtl) {
+    Value v;
+    if (tryGetRef(k, v)) {
+      return v;
+    }
+    std::shared_future<Value> pending;
+    {
+      Guard g(lock_);
+      // the fast path already counted this lookup as a miss
+      const auto iter = cache_.find(k);
+      if (iter != cache_.end() && !expiry_.expired(*iter->second)) {
+        policy_.onHit(keys_, iter->second);
+        return iter->second->value;
+      }
+      const auto flight = flights_.find(k);
+      if (flight != flights_.end()) {
+        pending = flight->second.result;
+      } else {
+        flights_.emplace(std::piecewise_construct, std::forward_as_tuple(k),
+                         std::forward_as_tuple());
+      }
+    }
+    if (pending.valid()) {
+      return pending.get();
+    }
+    try {
+      v = loader(k);
+    } catch (...) {
+      failLoad(k, std::current_exception());
+      throw;
+    }
+    endLoad_impl(k, v, ownTtl ? ttl : expiry_.defaultTtl());
+    return v;
+  }
+
+  void endLoad_impl(const Key& k, const Value& v, duration ttl) {
+    flight_type f;
+    {
+      WriteGuard g(*this);
+      insert_nolock(k, v, ttl);
+      takeFlight_nolock(k, f);
+    }
+    f.done.set_value(v);
+    wake(f);
+  }
+  // moves the flight of k (if any) into f and ends it
+  void takeFlight_nolock(const Key& k, flight_type& f) {
+    const auto flight = flights_.find(k);
+    if (flight != flights_.end()) {
+      f.done = std::move(flight->second.done);
+      f.result = std::move(flight->second.result);
+      f.waiters.swap(flight->second.waiters);
+      flights_.erase(flight);
+    }
+  }
+  static void wake(const flight_type& f) {
+    for (const auto& w : f.waiters) {
+      w(f.result);
+    }
+  }
+
+  // looks up keyAt(0..n) in chunks: first all the map probes, prefetching
+  // each hit's list node, then the policy updates and onHit(i, value)
+  // reads, so the node cache misses of a chunk overlap
+  template <class KeyAt, class OnHit>
+  size_t getMany_locked(size_t n, KeyAt keyAt, OnHit onHit) {
+    enum { kChunk = 16 };
+    typename list_type::iterator hits[kChunk];
+    size_t hitPos[kChunk];
+    size_t count = 0;
+    syncIfPending();
+    RefreshTicket t(*this);
+    ReadGuard g(lock_);
+    for (size_t base = 0; base < n; base += kChunk) {
+      const size_t end = std::min<size_t>(n, base + kChunk);
+      size_t m = 0;
+      for (size_t i = base; i < end; ++i) {
+        const auto iter = cache_.find(keyAt(i));
+        if (iter != cache_.end()) {
+          detail::prefetch(&*iter->second);
+          hits[m] = iter->second;
+          hitPos[m++] = i;
+        }
+      }
+      for (size_t j = 0; j < m; ++j) {
+        if (!expiry_.expired(*hits[j])) {
+          hit_nolock(hits[j], t);
+          onHit(hitPos[j], hits[j]->value);
+          ++count;
+        }
+      }
+    }
+    stats_.miss(n - count);
+    return count;
+  }
+  // inserts a pair like object, moving from it if it is an rvalue
+  template <class P>
+  void insertOne_nolock(P&& kv) {
+    insert_nolock(std::forward<P>(kv).first, std::forward<P>(kv).second,
+                  expiry_.defaultTtl());
+  }
+  template <class K, class V>
+  bool insert_nolock(K&& k, V&& v, duration ttl) {
+    policy_.sync(keys_);
+    expire_nolock();
+    const auto slot = detail::tryEmplace(cache_, k, 0);
+    if (!slot.second) {
+      const auto iter = slot.first->second;
+      const size_t w = weigher_(iter->key, v);
+      if (maxWeight_ != 0 && w > maxWeight_) {
+        erase_nolock(iter, RemovalCause::kSize);
+        return false;
+      }
+      weight_ -= weigher_(iter->key, iter->value);
+      if (removed_ != nullptr) {
+        removed_->replaced(iter->key, std::move(iter->value));
+      }
+      iter->value = std::forward<V>(v);
+      stats_.update();
+      weight_ += w;
+      expiry_.schedule(*iter, ttl);
+      policy_.onHit(keys_, iter);
+      prune();
+      return false;
+    }
+    return link_nolock(slot.first, ttl, std::forward<K>(k),
+                       std::forward<V>(v));
+  }
+  template <class K, class... Args>
+  bool emplace_nolock(K&& k, Args&&... args) {
+    policy_.sync(keys_);
+    expire_nolock();
+    const auto slot = detail::tryEmplace(cache_, k, 0);
+    if (!slot.second) {
+      return false;
+    }
+    return link_nolock(slot.first, expiry_.defaultTtl(), std::forward<K>(k),
+                       std::forward<Args>(args)...);
+  }
+  // constructs the node for a key just added to the map (slot) and links it
+  // in, or drops both again if the entry is heavier than maxWeight
+  template <class... Args>
+  bool link_nolock(typename map_type::iterator slot, duration ttl,
+                   Args&&... args) {
+    try {
+      keys_.emplace_front(std::piecewise_construct,
+                          std::forward<Args>(args)...);
+    } catch (...) {
+      cache_.erase(slot);
+      throw;
+    }
+    const size_t w = weigher_(keys_.front().key, keys_.front().value);
+    if (maxWeight_ != 0 && w > maxWeight_) {
+      keys_.pop_front();
+      cache_.erase(slot);
+      return false;
+    }
+    slot->second = keys_.begin();
+    expiry_.schedule(keys_.front(), ttl);
+    weight_ += w;
+    stats_.insert();
+    policy_.onInsert(keys_, keys_.begin());
+    prune();
+    return true;
+  }
+  // the nodes removed under one WriteGuard, spliced out of keys_ as they are
+  // so eviction allocates nothing. a replaced value is moved into a node of
+  // its own
+  class RemovalBatch {
+   public:
+    // nodes are spliced in, so the batch must share the cache's allocator
+    explicit RemovalBatch(const typename list_type::allocator_type& a)
+        : nodes_(a) {}
+    void take(list_type& from, typename list_type::iterator first,
+              typename list_type::iterator last, RemovalCause cause) {
+      const size_t n = static_cast<size_t>(std::distance(first, last));
+      nodes_.splice(nodes_.end(), from, first, last);
+      causes_.insert(causes_.end(), n, cause);
+    }
+    void replaced(const Key& k, Value&& old) {
+      nodes_.emplace_back(std::piecewise_construct, k, std::move(old));
+      causes_.push_back(RemovalCause::kReplaced);
+    }
+    template <class F>
+    void deliver(F& listener) {
+      size_t i = 0;
+      for (auto& n : nodes_) {
+        listener(n.key, n.value, causes_[i++]);
+      }
+    }
+
+   private:
+    list_type nodes_;
+    std::vector<RemovalCause> causes_;
+  };
+  // the exclusive guard of the writing paths. with a removal listener set
+  // it collects what the call removes and delivers it after unlocking; the
+  // batch (a list bound to the cache's allocator) is only constructed then
+  class WriteGuard {
+   public:
+    explicit WriteGuard(Cache& c) : cache_(c), batch_(nullptr) {
+      if (cache_.listener_) {
+        batch_ = ::new (&storage_) RemovalBatch(c.keys_.get_allocator());
+      }
+      try {
+        cache_.lock_.lock();
+      } catch (...) {
+        destroyBatch();
+        throw;
+      }
+      cache_.removed_ = batch_;
+    }
+    ~WriteGuard() {
+      cache_.removed_ = nullptr;
+      cache_.lock_.unlock();
+      if (batch_ != nullptr) {
+        batch_->deliver(cache_.listener_);
+        destroyBatch();
+      }
+    }
+
+   private:
+    WriteGuard(const WriteGuard&) = delete;
+    WriteGuard& operator=(const WriteGuard&) = delete;
+
+    void destroyBatch() {
+      if (batch_ != nullptr) {
+        batch_->~RemovalBatch();
+        batch_ = nullptr;
+      }
+    }
+
+    Cache& cache_;
+    RemovalBatch* batch_;
+    typename std::aligned_storage<sizeof(RemovalBatch),
+                                  alignof(RemovalBatch)>::type storage_;
+  };
+  // collects the refreshes claimed by hits under the lock and hands them
+  // to the refresh executor once the lock is released, so declare it
+  // before the guard
+  class RefreshTicket {
+   public:
+    explicit RefreshTicket(Cache& c) : cache_(c) {}
+    ~RefreshTicket() {
+      for (const Key& k : keys_) {
+        Cache* c = &cache_;
+        cache_.refreshExecutor_([c, k]() { c->refresh(k); });
+      }
+    }
+    void claim(const Key& k) { keys_.push_back(k); }
+
+   private:
+    RefreshTicket(const RefreshTicket&) = delete;
+    RefreshTicket& operator=(const RefreshTicket&) = delete;
+
+    Cache& cache_;
+    std::vector<Key> keys_;
+  };
+
+  void hit_nolock(typename list_type::iterator it, RefreshTicket& t) {
+    stats_.hit();
+    policy_.onHit(keys_, it);
+    if (expiry_.claimRefresh(*it)) {
+      t.claim(it->key);
+    }
+  }
+  template <class K>
+  const Value& get_nolock(const K& k, RefreshTicket& t) {
+    const auto iter = cache_.find(k);
+    if (iter == cache_.end() || expiry_.expired(*iter->second)) {
+      stats_.miss();
+      throw KeyNotFound();
+    }
+    hit_nolock(iter->second, t);
+    return iter->second->value;
+  }
+  template <class K>
+  bool tryGetRef_nolock(const K& kIn, Value& vOut, RefreshTicket& t) {
+    const auto iter = cache_.find(kIn);
+    if (iter == cache_.end() || expiry_.expired(*iter->second)) {
+      stats_.miss();
+      return false;
+    }
+    hit_nolock(iter->second, t);
+    vOut = iter->second->value;
+    return true;
+  }
+  // runs on the refresh executor: reloads k and swaps the value in, unless
+  // the entry was removed in the meantime. a failed reload keeps the old
+  // value and re-arms the refresh
+  void refresh(const Key& k) {
+    try {
+      Value v = refreshLoader_(k);
+      WriteGuard g(*this);
+      if (cache_.find(k) != cache_.end()) {
+        insert_nolock(k, std::move(v), expiry_.defaultTtl());
+      }
+    } catch (...) {
+      Guard g(lock_);
+      const auto iter = cache_.find(k);
+      if (iter != cache_.end()) {
+        expiry_.armRefresh(*iter->second);
+      }
+    }
+  }
+  size_t prune() {
+    if (maxSize_ != 0 && cache_.size() >= maxSize_ + elasticity_) {
+      draining_ = true;
+    }
+    size_t count = 0;
+    if (draining_) {
+      count = trim_nolock(pruneBudget_ != 0 ? pruneBudget_ : cache_.size());
+    }
+    // the weight limit is hard, there is no elasticity for it
+    while (maxWeight_ != 0 && weight_ > maxWeight_ && !keys_.empty()) {
+      erase_nolock(policy_.victim(keys_), RemovalCause::kSize);
+      ++count;
+    }
+    if (count != 0) {
+      stats_.pruned(count);
+    }
+    return count;
+  }
+  void resize_nolock() {
+    policy_.resize(keys_, maxSize_, elasticity_);
+    if (maxSize_ == 0 || cache_.size() <= maxSize_) {
+      draining_ = false;
+      return;
+    }
+    draining_ = true;
+    policy_.sync(keys_);
+    const size_t count =
+        trim_nolock(pruneBudget_ != 0 ? pruneBudget_ : cache_.size());
+    if (count != 0) {
+      stats_.pruned(count);
+    }
+  }
+  // evicts up to budget entries over maxSize, the drain ends at maxSize
+  size_t trim_nolock(size_t budget) {
+    size_t count = 0;
+    while (count < budget && maxSize_ != 0 && cache_.size() > maxSize_) {
+      erase_nolock(policy_.victim(keys_), RemovalCause::kSize);
+      ++count;
+    }
+    if (cache_.size() <= maxSize_) {
+      draining_ = false;
+    }
+    return count;
+  }
+  template <class K>
+  bool remove_nolock(const K& k) {
+    policy_.sync(keys_);
+    auto iter = cache_.find(k);
+    if (iter == cache_.end()) {
+      return false;
+    }
+    weight_ -= weigher_(iter->second->key, iter->second->value);
+    expiry_.unschedule(*iter->second);
+    policy_.onErase(keys_, iter->second);
+    const auto node = iter->second;
+    cache_.erase(iter);
+    drop_nolock(node, RemovalCause::kExplicit);
+    return true;
+  }
+  template <class K>
+  bool contains_nolock(const K& k) const {
+    const auto iter = cache_.find(k);
+    return iter != cache_.end() && !expiry_.expired(*iter->second);
+  }
+  // appends the live entries to a snapshot body, returns their count
+  // appends the live entries to out, and the end offset of each to ends
+  template <class Serializer>
+  size_t serialize(std::string& out, const Serializer& s,
+                   std::vector<size_t>* ends = nullptr) const {
+    std::string scratch;
+    size_t count = 0;
+    ProbeGuard g(lock_);
+    for (const auto& n : keys_) {
+      if (!expiry_.expired(n)) {
+        detail::putSnapshotRecord(out, scratch, s, n.key, n.value);
+        if (ends != nullptr) {
+          ends->push_back(out.size());
+        }
+        ++count;
+      }
+    }
+    return count;
+  }
+  template <class K>
+  bool tryPeek_nolock(const K& kIn, Value& vOut) const {
+    const auto iter = cache_.find(kIn);
+    if (iter == cache_.end() || expiry_.expired(*iter->second)) {
+      return false;
+    }
+    vOut = iter->second->value;
+    return true;
+  }
+  template <class K>
+  Value peek_nolock(const K& k) const {
+    const auto iter = cache_.find(k);
+    if (iter == cache_.end() || expiry_.expired(*iter->second)) {
+      throw KeyNotFound();
+    }
+    return iter->second->value;
+  }
+  // reclaims the entries the timing wheel reports as expired
+  void expire_nolock() {
+    expiry_.advance([this](node_type& n) {
+      const auto iter = cache_.find(n.key);
+      erase_nolock(iter->second, RemovalCause::kExpired);
+    });
+  }
+  void erase_nolock(typename list_type::iterator it, RemovalCause cause) {
+    weight_ -= weigher_(it->key, it->value);
+    expiry_.unschedule(*it);
+    cache_.erase(it->key);
+    policy_.onErase(keys_, it);
+    drop_nolock(it, cause);
+  }
+  // removes the run of keys from lower_bound(first) on that satisfy inSpan,
+  // then erases them from the map in one go
+  template <class InSpan>
+  size_t removeSpan_nolock(const Key& first, InSpan inSpan) {
+    policy_.sync(keys_);
+    const auto begin = cache_.lower_bound(first);
+    auto end = begin;
+    size_t count = 0;
+    for (; end != cache_.end() && inSpan(end->first); ++end, ++count) {
+      const auto it = end->second;
+      weight_ -= weigher_(it->key, it->value);
+      expiry_.unschedule(*it);
+      policy_.onErase(keys_, it);
+      drop_nolock(it, RemovalCause::kExplicit);
+    }
+    cache_.erase(begin, end);
+    return count;
+  }
+  // frees an unlinked node, or hands it to the removal batch
+  void drop_nolock(typename list_type::iterator it, RemovalCause cause) {
+    stats_.removed(cause);
+    if (removed_ != nullptr) {
+      removed_->take(keys_, it, std::next(it), cause);
+    } else {
+      keys_.erase(it);
+    }
+  }
+  // replays deferred hits once the calling thread's read buffer is full.
+  // never blocks: if the lock is busy the next writer will do it
+  void syncIfPending() {
+    if (policy_.pendingFull() && lock_.try_lock()) {
+      policy_.sync(keys_);
+      lock_.unlock();
+    }
+  }
+
+ private:
+  // Disallow copying.
+  Cache(const Cache&) = delete;
+  Cache& operator=(const Cache&) = delete;
+
+  mutable guarded_lock_type lock_;
+  map_type cache_;
+  list_type keys_;
+  policy_type policy_;
+  expiry_type expiry_;
+  size_t maxSize_;
+  size_t elasticity_;
+  size_t maxWeight_;
+  size_t weight_;
+  Weigher weigher_;
+  size_t pruneBudget_;
+  // between reaching the hard limit and getting back to maxSize
+  bool draining_;
+  Stats stats_;
+  // in flight getOrLoad() / beginLoad() loads
+  typename detail::SideMap<Map, Key, flight_type>::type flights_;
+  std::function<Value(const Key&)> refreshLoader_;
+  std::function<void(std::function<void()>)> refreshExecutor_;
+  std::function<void(const Key&, Value&, RemovalCause)> listener_;
+  // the batch of the WriteGuard holding the lock, if listening
+  RemovalBatch* removed_;
+};
+
+/**
+ *	A read only, reference counted handle to a cached value. A handle
+ *returned by getCopy()/tryGetCopy() stays valid after the entry is
+ *replaced or evicted: eviction only drops the cache's reference.
  */
-class KeyNotFound : public std::invalid_argument {
- public:
-  KeyNotFound() : std::invalid_argument("key_not_found") {}
-};
+template <class T>
+using ValueHandle = std::shared_ptr<const T>;
 
-template <typename K, typename V>
-struct KeyValuePair {
- public:
-  K key;
-  V value;
+/**
+ *	Cache<Key, Value, Policies<...>>: the Cache of the features the bundle
+ *names, see Policies
+ */
+template <class Key, class Value, class... Fs>
+class Cache<Key, Value, Policies<Fs...>>
+    : public Cache<Key, Value,
+                   typename detail::PolicyBundle<Key, Value, Fs...>::lock,
+                   typename detail::PolicyBundle<Key, Value, Fs...>::map,
+                   typename detail::PolicyBundle<Key, Value, Fs...>::policy,
+                   typename detail::PolicyBundle<Key, Value, Fs...>::weigher,
+                   typename detail::PolicyBundle<Key, Value, Fs...>::expiry,
+                   typename detail::PolicyBundle<Key, Value, Fs...>::stats,
+                   typename detail::PolicyBundle<Key, Value, Fs...>::allocator> {
+  typedef detail::PolicyBundle<Key, Value, Fs...> bundle;
 
-  KeyValuePair(K k, V v) : key(std::move(k)), value(std::move(v)) {}
+ public:
+  typedef Cache<Key, Value, typename bundle::lock, typename bundle::map,
+                typename bundle::policy, typename bundle::weigher,
+                typename bundle::expiry, typename bundle::stats,
+                typename bundle::allocator>
+      cache_type;
+  using cache_type::cache_type;
 };
 
 /**
- *	The LRU Cache class templated by
- *		Key - key type
- *		Value - value type
- *		MapType - an associative container like std::unordered_map
- *		LockType - a lock type derived from the Lock class (default:
- *NullLock = no synchronization)
+ *	A Cache whose values are ValueHandle<T>: reads copy a pointer (one
+ *refcount increment under the lock) instead of the value, and callers use
+ *the value without holding the cache lock. insert with
+ *std::make_shared<const T>(...). A custom Weigher gets the handle.
+ */
+template <class Key, class T, class Lock = NullLock,
+          class Map = std::unordered_map<
+              Key, typename std::list<
+                       KeyValuePair<Key, ValueHandle<T>>>::iterator>,
+          class Policy = LRUPolicy, class Weigher = NoWeigher,
+          class Expiry = NoExpiry, class Stats = NoStats,
+          class Allocator = std::allocator<char>>
+using SharedValueCache = Cache<Key, ValueHandle<T>, Lock, Map, Policy, Weigher,
+                               Expiry, Stats, Allocator>;
+
+/**
+ *	A ShardedCache spreads keys over N independent Cache shards, each with its
+ *own lock, LRU list and maxSize/elasticity budget. With Lock=std::mutex
+ *threads working on different shards no longer serialize on a single lock.
  *
- *	The default NullLock based template is not thread-safe, however passing
- *Lock=std::mutex will make it
- *	thread-safe
+ *	The LRU order is per shard, so eviction is only approximately LRU
+ *across the whole cache.
+ *
+ *		Hash - hash functor used to pick the shard (default: std::hash<Key>)
+ *		Policy - eviction policy of every shard (default: LRUPolicy)
+ *		Weigher - entry weigher of every shard (default: NoWeigher)
+ *		Expiry - time to live support of every shard (default: NoExpiry)
+ *		Stats - statistics of every shard, summed by getStats() (default:
+ *NoStats)
+ *		Allocator - allocator of every shard (default: std::allocator)
  */
 template <class Key, class Value, class Lock = NullLock,
           class Map = std::unordered_map<
-              Key, typename std::list<KeyValuePair<Key, Value>>::iterator>>
-class Cache {
+              Key, typename std::list<KeyValuePair<Key, Value>>::iterator>,
+          class Hash = std::hash<Key>, class Policy = LRUPolicy,
+          class Weigher = NoWeigher, class Expiry = NoExpiry,
+          class Stats = NoStats, class Allocator = std::allocator<char>>
+class ShardedCache {
  public:
-  typedef KeyValuePair<Key, Value> node_type;
-  typedef std::list<KeyValuePair<Key, Value>> list_type;
-  typedef Map map_type;
+  typedef Cache<Key, Value, Lock, Map, Policy, Weigher, Expiry, Stats,
+                Allocator>
+      shard_type;
+  typedef Key key_type;
+  typedef Value mapped_type;
+  typedef typename shard_type::duration duration;
+  typedef typename shard_type::LoadWaiter LoadWaiter;
+  typedef typename shard_type::node_type node_type;
+  typedef typename shard_type::list_type list_type;
+  typedef typename shard_type::map_type map_type;
   typedef Lock lock_type;
-  using Guard = std::lock_guard<lock_type>;
+  // enables the heterogeneous lookup overloads for non-Key lookup types
+  template <class K>
+  using EnableTransparent = typename std::enable_if<
+      detail::has_is_transparent<Hash>::value &&
+      detail::is_transparent_map<map_type>::value &&
+      !std::is_same<typename std::decay<K>::type, Key>::value>::type;
   /**
-   * the maxSize is the soft limit of keys and (maxSize + elasticity) is the
-   * hard limit
-   * the cache is allowed to grow till (maxSize + elasticity) and is pruned back
-   * to maxSize keys
-   * set maxSize = 0 for an unbounded cache (but in that case, you're better off
-   * using a std::unordered_map
-   * directly anyway! :)
+   * maxSize, elasticity and maxWeight are totals for the whole cache and are
+   * split evenly (rounded up) across the shards. shardCount is rounded up to
+   * a power of two.
    */
-  explicit Cache(size_t maxSize = 64, size_t elasticity = 10)
-      : maxSize_(maxSize), elasticity_(elasticity) {}
-  virtual ~Cache() = default;
+  explicit ShardedCache(size_t maxSize = 64, size_t elasticity = 10,
+                        size_t shardCount = 16, size_t maxWeight = 0,
+                        const Hash& hash = Hash(),
+                        const Weigher& weigher = Weigher(),
+                        const Allocator& alloc = Allocator())
+      : hash_(hash), shardBits_(0) {
+    while ((size_t(1) << shardBits_) < shardCount) {
+      ++shardBits_;
+    }
+    const size_t n = size_t(1) << shardBits_;
+    const size_t shardMax = (maxSize + n - 1) / n;
+    const size_t shardElasticity = (elasticity + n - 1) / n;
+    const size_t shardWeight = (maxWeight + n - 1) / n;
+    shards_.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+      shards_.push_back(std::unique_ptr<shard_type>(
+          new shard_type(shardMax, shardElasticity, shardWeight, weigher,
+                         alloc)));
+    }
+  }
+  virtual ~ShardedCache() = default;
+
   size_t size() const {
-    Guard g(lock_);
-    return cache_.size();
+    size_t total = 0;
+    for (const auto& s : shards_) {
+      total += s->size();
+    }
+    return total;
   }
   bool empty() const {
-    Guard g(lock_);
-    return cache_.empty();
+    for (const auto& s : shards_) {
+      if (!s->empty()) {
+        return false;
+      }
+    }
+    return true;
   }
   void clear() {
-    Guard g(lock_);
-    cache_.clear();
-    keys_.clear();
+    for (const auto& s : shards_) {
+      s->clear();
+    }
   }
-  void insert(const Key& k, Value v) {
-    Guard g(lock_);
-    const auto iter = cache_.find(k);
-    if (iter != cache_.end()) {
-      iter->second->value = v;
-      keys_.splice(keys_.begin(), keys_, iter->second);
-      return;
+  void insert(const Key& k, Value v) { shardFor(k).insert(k, std::move(v)); }
+  void insert(Key&& k, Value&& v) {
+    shard_type& s = shardFor(k);
+    s.insert(std::move(k), std::move(v));
+  }
+  void insert(const Key& k, Value v, duration ttl) {
+    shardFor(k).insert(k, std::move(v), ttl);
+  }
+  void insert(Key&& k, Value&& v, duration ttl) {
+    shard_type& s = shardFor(k);
+    s.insert(std::move(k), std::move(v), ttl);
+  }
+  bool insert_or_assign(const Key& k, Value v) {
+    return shardFor(k).insert_or_assign(k, std::move(v));
+  }
+  bool insert_or_assign(Key&& k, Value&& v) {
+    shard_type& s = shardFor(k);
+    return s.insert_or_assign(std::move(k), std::move(v));
+  }
+  template <class... Args>
+  bool emplace(const Key& k, Args&&... args) {
+    return shardFor(k).emplace(k, std::forward<Args>(args)...);
+  }
+  template <class... Args>
+  bool emplace(Key&& k, Args&&... args) {
+    shard_type& s = shardFor(k);
+    return s.emplace(std::move(k), std::forward<Args>(args)...);
+  }
+  void setDefaultTtl(duration ttl) {
+    for (const auto& s : shards_) {
+      s->setDefaultTtl(ttl);
+    }
+  }
+  duration getDefaultTtl() const { return shards_[0]->getDefaultTtl(); }
+  // see Cache::setRemovalListener(), applied to every shard
+  void setRemovalListener(
+      std::function<void(const Key&, Value&, RemovalCause)> listener) {
+    for (const auto& s : shards_) {
+      s->setRemovalListener(listener);
+    }
+  }
+  // see Cache::setRefresh(), applied to every shard
+  void setRefresh(duration refreshAfter,
+                  std::function<Value(const Key&)> loader,
+                  std::function<void(std::function<void()>)> executor) {
+    for (const auto& s : shards_) {
+      s->setRefresh(refreshAfter, loader, executor);
     }
-
-    keys_.emplace_front(k, std::move(v));
-    cache_[k] = keys_.begin();
-    prune();
   }
-  /**
-    for backward compatibity. redirects to tryGetCopy()
-   */
   bool tryGet(const Key& kIn, Value& vOut) {
-    return tryGetCopy(kIn, vOut);
+    return shardFor(kIn).tryGet(kIn, vOut);
   }
-
   bool tryGetCopy(const Key& kIn, Value& vOut) {
-    Guard g(lock_);
-    Value tmp;
-    if (!tryGetRef_nolock(kIn, tmp)) { return false; }
-    vOut = tmp;
-    return true;
+    return shardFor(kIn).tryGetCopy(kIn, vOut);
   }
-  
   bool tryGetRef(const Key& kIn, Value& vOut) {
-    Guard g(lock_);
-    return tryGetRef_nolock(kIn, vOut);
+    return shardFor(kIn).tryGetRef(kIn, vOut);
   }
   /**
-   *	The const reference returned here is only
-   *    guaranteed to be valid till the next insert/delete
-   *  in multi-threaded apps use getCopy() to be threadsafe
+   *	same caveat as Cache::getRef() - the reference is only valid till
+   *the next insert/delete on the owning shard
    */
-  const Value& getRef(const Key& k) {
-    Guard g(lock_);
-    return get_nolock(k);
+  const Value& getRef(const Key& k) { return shardFor(k).getRef(k); }
+  Value get(const Key& k) { return shardFor(k).get(k); }
+  Value getCopy(const Key& k) { return shardFor(k).getCopy(k); }
+  bool remove(const Key& k) { return shardFor(k).remove(k); }
+  // see Cache::removeRange(), keys are hashed so every shard is visited
+  size_t removeRange(const Key& lo, const Key& hi) {
+    size_t count = 0;
+    for (const auto& s : shards_) {
+      count += s->removeRange(lo, hi);
+    }
+    return count;
+  }
+  size_t removePrefix(const Key& prefix) {
+    size_t count = 0;
+    for (const auto& s : shards_) {
+      count += s->removePrefix(prefix);
+    }
+    return count;
+  }
+  bool contains(const Key& k) const { return shardFor(k).contains(k); }
+  // see Cache::peek(), no promotion
+  bool tryPeek(const Key& kIn, Value& vOut) const {
+    return shardFor(kIn).tryPeek(kIn, vOut);
   }
+  Value peek(const Key& k) const { return shardFor(k).peek(k); }
 
   /**
-      added for backward compatibility
+   * heterogeneous lookups, see Cache. the shard Hash has to be transparent
+   * too (and hash equal keys of either type the same way)
    */
-  Value get(const Key& k) {
-    return getCopy();
+  template <class K, class = EnableTransparent<K>>
+  bool tryGet(const K& kIn, Value& vOut) {
+    return shardFor(kIn).tryGet(kIn, vOut);
+  }
+  template <class K, class = EnableTransparent<K>>
+  bool tryGetCopy(const K& kIn, Value& vOut) {
+    return shardFor(kIn).tryGetCopy(kIn, vOut);
+  }
+  template <class K, class = EnableTransparent<K>>
+  bool tryGetRef(const K& kIn, Value& vOut) {
+    return shardFor(kIn).tryGetRef(kIn, vOut);
+  }
+  template <class K, class = EnableTransparent<K>>
+  const Value& getRef(const K& k) {
+    return shardFor(k).getRef(k);
+  }
+  template <class K, class = EnableTransparent<K>>
+  Value get(const K& k) {
+    return shardFor(k).get(k);
+  }
+  template <class K, class = EnableTransparent<K>>
+  Value getCopy(const K& k) {
+    return shardFor(k).getCopy(k);
+  }
+  template <class K, class = EnableTransparent<K>>
+  bool remove(const K& k) {
+    return shardFor(k).remove(k);
+  }
+  template <class K, class = EnableTransparent<K>>
+  bool contains(const K& k) const {
+    return shardFor(k).contains(k);
+  }
+  template <class K, class = EnableTransparent<K>>
+  bool tryPeek(const K& kIn, Value& vOut) const {
+    return shardFor(kIn).tryPeek(kIn, vOut);
+  }
+  template <class K, class = EnableTransparent<K>>
+  Value peek(const K& k) const {
+    return shardFor(k).peek(k);
+  }
+
+  size_t getMaxSize() const { return shards_.size() * shards_[0]->getMaxSize(); }
+  size_t getElasticity() const {
+    return shards_.size() * shards_[0]->getElasticity();
+  }
+  size_t getMaxAllowedSize() const { return getMaxSize() + getElasticity(); }
+  // see Cache::setMaxSize(), the total is split evenly (rounded up) across
+  // the shards like in the constructor
+  void setMaxSize(size_t maxSize) {
+    const size_t n = shards_.size();
+    for (const auto& s : shards_) {
+      s->setMaxSize((maxSize + n - 1) / n);
+    }
+  }
+  void setElasticity(size_t elasticity) {
+    const size_t n = shards_.size();
+    for (const auto& s : shards_) {
+      s->setElasticity((elasticity + n - 1) / n);
+    }
+  }
+  // see Cache::reserve(), n entries in total
+  void reserve(size_t n) {
+    const size_t m = shards_.size();
+    for (const auto& s : shards_) {
+      s->reserve((n + m - 1) / m);
+    }
+  }
+  size_t getMaxWeight() const {
+    return shards_.size() * shards_[0]->getMaxWeight();
+  }
+  // see Cache::setPruneBudget(), the budget applies per shard
+  void setPruneBudget(size_t budget) {
+    for (const auto& s : shards_) {
+      s->setPruneBudget(budget);
+    }
   }
+  size_t getPruneBudget() const { return shards_[0]->getPruneBudget(); }
   /**
-   * returns a copy of the stored object (if found)
-   * safe to use/recommended in multi-threaded apps
+   * see Cache::saveSnapshot(). the shards are interleaved round-robin, the
+   * most recent entry of each shard, then the second most recent and so
+   * on, so that any prefix of the snapshot holds about the most recent
+   * entries overall and a smaller Cache or ShardedCache can load it. each
+   * shard is encoded under its own lock, the snapshot is not a point in
+   * time across shards
    */
-  Value getCopy(const Key& k) {
-    Guard g(lock_);
-    return get_nolock(k);
+  template <class Serializer = SnapshotSerializer<Key, Value>>
+  size_t saveSnapshot(const std::string& path,
+                      const Serializer& s = Serializer()) const {
+    std::vector<std::string> bodies(shards_.size());
+    std::vector<std::vector<size_t>> ends(shards_.size());
+    size_t count = 0;
+    size_t bytes = 0;
+    size_t longest = 0;
+    for (size_t j = 0; j < shards_.size(); ++j) {
+      count += shards_[j]->serialize(bodies[j], s, &ends[j]);
+      bytes += bodies[j].size();
+      longest = std::max(longest, ends[j].size());
+    }
+    std::string body;
+    body.reserve(bytes);
+    for (size_t i = 0; i < longest; ++i) {
+      for (size_t j = 0; j < shards_.size(); ++j) {
+        if (i < ends[j].size()) {
+          const size_t from = i == 0 ? 0 : ends[j][i - 1];
+          body.append(bodies[j], from, ends[j][i] - from);
+        }
+      }
+    }
+    detail::writeSnapshotFile(path, body, count);
+    return count;
   }
-
-  bool remove(const Key& k) {
-    Guard g(lock_);
-    auto iter = cache_.find(k);
-    if (iter == cache_.end()) {
-      return false;
+  /**
+   * see Cache::loadSnapshot(), each entry goes to its own shard. every
+   * shard keeps at most its maxSize entries, the first ones the snapshot
+   * lists for it (its most recent, for a snapshot of a Cache or
+   * ShardedCache), and is filled under one lock acquisition. returns the
+   * number loaded
+   */
+  template <class Serializer = SnapshotSerializer<Key, Value>>
+  size_t loadSnapshot(const std::string& path,
+                      const Serializer& s = Serializer()) {
+    const detail::MappedFile file(path);
+    const std::vector<detail::SnapshotRecord> records =
+        detail::parseSnapshot(file);
+    std::vector<size_t> room(shards_.size());
+    for (size_t j = 0; j < shards_.size(); ++j) {
+      typename shard_type::Guard g(shards_[j]->lock_);
+      room[j] = shards_[j]->maxSize_ != 0 ? shards_[j]->maxSize_
+                                          : records.size();
     }
-    keys_.erase(iter->second);
-    cache_.erase(iter);
-    return true;
+    // per shard, (record, key) of the entries it keeps, most recent first
+    std::vector<std::vector<std::pair<size_t, Key>>> kept(shards_.size());
+    size_t loaded = 0;
+    for (size_t i = 0; i < records.size(); ++i) {
+      const detail::SnapshotRecord& r = records[i];
+      Key k = s.readKey(r.key, r.keySize);
+      const size_t j = shardOf(k);
+      if (kept[j].size() < room[j]) {
+        kept[j].emplace_back(i, std::move(k));
+        ++loaded;
+      }
+    }
+    // one lock acquisition per shard, each filled LRU first
+    for (size_t j = 0; j < shards_.size(); ++j) {
+      shard_type& shard = *shards_[j];
+      typename shard_type::WriteGuard g(shard);
+      detail::reserveMap(shard.cache_, shard.cache_.size() + kept[j].size(),
+                         0);
+      for (size_t i = kept[j].size(); i-- > 0;) {
+        const detail::SnapshotRecord& r = records[kept[j][i].first];
+        shard.insert_nolock(std::move(kept[j][i].second),
+                            s.readValue(r.value, r.valueSize),
+                            shard.expiry_.defaultTtl());
+      }
+    }
+    return loaded;
   }
-  bool contains(const Key& k) const {
-    Guard g(lock_);
-    return cache_.find(k) != cache_.end();
+  // see Cache::maintain(), runs each shard with the given budget
+  size_t maintain(size_t budgetPerShard) {
+    size_t count = 0;
+    for (const auto& s : shards_) {
+      count += s->maintain(budgetPerShard);
+    }
+    return count;
   }
-
-  size_t getMaxSize() const { return maxSize_; }
-  size_t getElasticity() const { return elasticity_; }
-  size_t getMaxAllowedSize() const { return maxSize_ + elasticity_; }
+  size_t currentWeight() const {
+    size_t total = 0;
+    for (const auto& s : shards_) {
+      total += s->currentWeight();
+    }
+    return total;
+  }
+  // the shards' statistics summed up
+  StatsSnapshot getStats() const {
+    StatsSnapshot total;
+    for (const auto& s : shards_) {
+      total += s->getStats();
+    }
+    return total;
+  }
+  /**
+   * see Cache::getOrLoad(), single-flighting is per shard
+   */
+  template <class Loader>
+  Value getOrLoad(const Key& k, Loader&& loader) {
+    return shardFor(k).getOrLoad(k, std::forward<Loader>(loader));
+  }
+  template <class Loader>
+  Value getOrLoad(const Key& k, Loader&& loader, duration ttl) {
+    return shardFor(k).getOrLoad(k, std::forward<Loader>(loader), ttl);
+  }
+  // see Cache::beginLoad()
+  LoadState beginLoad(const Key& k, Value& vOut, LoadWaiter onReady,
+                      bool claim = true) {
+    return shardFor(k).beginLoad(k, vOut, std::move(onReady), claim);
+  }
+  void endLoad(const Key& k, const Value& v) { shardFor(k).endLoad(k, v); }
+  void endLoad(const Key& k, const Value& v, duration ttl) {
+    shardFor(k).endLoad(k, v, ttl);
+  }
+  void failLoad(const Key& k, std::exception_ptr e) {
+    shardFor(k).failLoad(k, e);
+  }
+  /**
+   * batched lookup, see Cache::getMany(). keys are grouped by shard (all
+   * the hashes are computed up front) and each shard with keys in the batch
+   * is locked once
+   */
+  template <class Keys>
+  size_t getMany(const Keys& keys, std::vector<Value>& values,
+                 std::vector<bool>& found) {
+    values.resize(keys.size());
+    found.assign(keys.size(), false);
+    std::vector<size_t> order;
+    std::vector<size_t> start;
+    groupByShard(keys.size(),
+                 [&keys](size_t i) -> const Key& { return keys[i]; }, order,
+                 start);
+    size_t hits = 0;
+    for (size_t s = 0; s < shards_.size(); ++s) {
+      if (start[s] == start[s + 1]) {
+        continue;
+      }
+      const size_t* pos = &order[start[s]];
+      hits += shards_[s]->getMany_locked(
+          start[s + 1] - start[s],
+          [&keys, pos](size_t j) -> const Key& { return keys[pos[j]]; },
+          [&values, &found, pos](size_t j, const Value& v) {
+            values[pos[j]] = v;
+            found[pos[j]] = true;
+          });
+    }
+    return hits;
+  }
+  /**
+   * batched insert of the (key, value) pairs of [first, last) (a forward
+   * range), each shard is locked once
+   */
+  template <class It>
+  void insertMany(It first, It last) {
+    std::vector<It> items;
+    for (; first != last; ++first) {
+      items.push_back(first);
+    }
+    std::vector<size_t> order;
+    std::vector<size_t> start;
+    groupByShard(items.size(),
+                 [&items](size_t i) -> const Key& { return items[i]->first; },
+                 order, start);
+    for (size_t s = 0; s < shards_.size(); ++s) {
+      if (start[s] == start[s + 1]) {
+        continue;
+      }
+      shard_type& shard = *shards_[s];
+      typename shard_type::WriteGuard g(shard);
+      for (size_t j = start[s]; j < start[s + 1]; ++j) {
+        shard.insertOne_nolock(*items[order[j]]);
+      }
+    }
+  }
+  template <class Range>
+  void insertMany(const Range& items) {
+    insertMany(std::begin(items), std::end(items));
+  }
+  /**
+   * walks the shards one after the other, each shard in its own LRU order.
+   * only one shard is locked at a time
+   */
   template <typename F>
   void cwalk(F& f) const {
-    Guard g(lock_);
-    std::for_each(keys_.begin(), keys_.end(), f);
-  }
-
- protected:
-  const Value& get_nolock(const Key& k) {
-    const auto iter = cache_.find(k);
-    if (iter == cache_.end()) {
-      throw KeyNotFound();
+    for (const auto& s : shards_) {
+      s->cwalk(f);
     }
-    keys_.splice(keys_.begin(), keys_, iter->second);
-    return iter->second->value;
   }
-  bool tryGetRef_nolock(const Key& kIn, Value& vOut) {
-    const auto iter = cache_.find(kIn);
-    if (iter == cache_.end()) {
-      return false;
+
+  size_t shardCount() const { return shards_.size(); }
+  // see Cache::checkInvariants(), every shard
+  bool checkInvariants() const {
+    for (const auto& s : shards_) {
+      if (!s->checkInvariants()) {
+        return false;
+      }
     }
-    keys_.splice(keys_.begin(), keys_, iter->second);
-    vOut = iter->second->value;
     return true;
   }
-  size_t prune() {
-    size_t maxAllowed = maxSize_ + elasticity_;
-    if (maxSize_ == 0 || cache_.size() < maxAllowed) {
+  template <class K>
+  size_t shardOf(const K& k) const {
+    if (shardBits_ == 0) {
       return 0;
     }
-    size_t count = 0;
-    while (cache_.size() > maxSize_) {
-      cache_.erase(keys_.back().key);
-      keys_.pop_back();
-      ++count;
+    return static_cast<size_t>(
+        detail::mixHash(static_cast<uint64_t>(hash_(k))) >> (64 - shardBits_));
+  }
+  shard_type& shard(size_t i) { return *shards_[i]; }
+  const shard_type& shard(size_t i) const { return *shards_[i]; }
+
+ protected:
+  // counting sort of the positions 0..n by the shard of keyAt(i): the
+  // positions for shard s end up in order[start[s] .. start[s + 1])
+  template <class KeyAt>
+  void groupByShard(size_t n, KeyAt keyAt, std::vector<size_t>& order,
+                    std::vector<size_t>& start) const {
+    std::vector<size_t> shardIdx(n);
+    start.assign(shards_.size() + 1, 0);
+    for (size_t i = 0; i < n; ++i) {
+      shardIdx[i] = shardOf(keyAt(i));
+      ++start[shardIdx[i] + 1];
     }
-    return count;
+    for (size_t s = 0; s < shards_.size(); ++s) {
+      start[s + 1] += start[s];
+    }
+    std::vector<size_t> next(start.begin(), start.end() - 1);
+    order.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+      order[next[shardIdx[i]]++] = i;
+    }
+  }
+  template <class K>
+  shard_type& shardFor(const K& k) {
+    return *shards_[shardOf(k)];
+  }
+  template <class K>
+  const shard_type& shardFor(const K& k) const {
+    return *shards_[shardOf(k)];
   }
 
  private:
   // Disallow copying.
-  Cache(const Cache&) = delete;
-  Cache& operator=(const Cache&) = delete;
+  ShardedCache(const ShardedCache&) = delete;
+  ShardedCache& operator=(const ShardedCache&) = delete;
 
-  mutable Lock lock_;
-  Map cache_;
-  list_type keys_;
-  size_t maxSize_;
-  size_t elasticity_;
+  Hash hash_;
+  size_t shardBits_;
+  std::vector<std::unique_ptr<shard_type>> shards_;
+};
+
+/**
+ *	ShardedCache<Key, Value, Policies<...>>, see Policies (UseHash<> picks
+ *the shard hash)
+ */
+template <class Key, class Value, class... Fs>
+class ShardedCache<Key, Value, Policies<Fs...>>
+    : public ShardedCache<
+          Key, Value, typename detail::PolicyBundle<Key, Value, Fs...>::lock,
+          typename detail::PolicyBundle<Key, Value, Fs...>::map,
+          typename detail::PolicyBundle<Key, Value, Fs...>::hash,
+          typename detail::PolicyBundle<Key, Value, Fs...>::policy,
+          typename detail::PolicyBundle<Key, Value, Fs...>::weigher,
+          typename detail::PolicyBundle<Key, Value, Fs...>::expiry,
+          typename detail::PolicyBundle<Key, Value, Fs...>::stats,
+          typename detail::PolicyBundle<Key, Value, Fs...>::allocator> {
+  typedef detail::PolicyBundle<Key, Value, Fs...> bundle;
+
+ public:
+  typedef ShardedCache<Key, Value, typename bundle::lock,
+                       typename bundle::map, typename bundle::hash,
+                       typename bundle::policy, typename bundle::weigher,
+                       typename bundle::expiry, typename bundle::stats,
+                       typename bundle::allocator>
+      cache_type;
+  using cache_type::cache_type;
 };
 
+#if __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<memory_resource>)
+/**
+ *	lru11::pmr::Cache / lru11::pmr::ShardedCache allocate their nodes from a
+ *std::pmr::memory_resource passed to the constructor, e.g.
+ *
+ *		std::pmr::unsynchronized_pool_resource pool;
+ *		lru11::pmr::Cache<int, int> cache(1024, 64, 0, lru11::NoWeigher(), &pool);
+ */
+namespace pmr {
+template <class Key, class Value, class Lock = NullLock,
+          class Map = std::unordered_map<
+              Key, typename std::list<KeyValuePair<Key, Value>>::iterator>,
+          class Policy = LRUPolicy, class Weigher = NoWeigher,
+          class Expiry = NoExpiry, class Stats = NoStats>
+using Cache = lru11::Cache<Key, Value, Lock, Map, Policy, Weigher, Expiry,
+                           Stats, std::pmr::polymorphic_allocator<char>>;
+template <class Key, class Value, class Lock = NullLock,
+          class Map = std::unordered_map<
+              Key, typename std::list<KeyValuePair<Key, Value>>::iterator>,
+          class Hash = std::hash<Key>, class Policy = LRUPolicy,
+          class Weigher = NoWeigher, class Expiry = NoExpiry,
+          class Stats = NoStats>
+using ShardedCache =
+    lru11::ShardedCache<Key, Value, Lock, Map, Hash, Policy, Weigher, Expiry,
+                        Stats, std::pmr::polymorphic_allocator<char>>;
+}  // namespace pmr
+#endif
+#endif
+
 }  // namespace LRUCache11
@@ -0,0 +1,210 @@
+/*
+ * LRUCache11 - a templated C++11 based LRU cache class that allows
+ * specification of
+ * key, value and optionally the map container type (defaults to
+ * std::unordered_map)
+ *
+ * LRUCache11Async.hpp - C++20 coroutine lookups for event loop servers.
+ * co_await lru11::getOrLoadAsync(cache, k, loader) completes inline on a
+ * hit and otherwise suspends the coroutine on the cache's single-flight
+ * load of k (see Cache::beginLoad()) instead of blocking the thread. The
+ * core headers stay C++11, only this one needs C++20.
+ *
+ * Github: https://github.com/mohaps/lrucache11
+ *
+ * Copyright (c) 2012-22 SAURAV MOHAPATRA <mohaps@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#pragma once
+#if __cplusplus < 202002L || !defined(__cpp_impl_coroutine)
+#error "LRUCache11Async.hpp needs C++20 coroutines"
+#endif
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <type_traits>
+
+#include "LRUCache11.hpp"
+
+namespace lru11 {
+
+namespace detail {
+// a coroutine that starts eagerly and frees itself when it finishes
+struct Detached {
+  struct promise_type {
+    Detached get_return_object() { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+// the state shared by the lookup awaiters
+template <class C>
+class AwaitBase {
+ public:
+  typedef typename C::LoadWaiter LoadWaiter;
+
+ protected:
+  AwaitBase(C& cache, const typename C::key_type& k)
+      : cache_(cache), key_(k) {}
+
+  // resumes h with the result of the load it waited on
+  LoadWaiter resumeWith(std::coroutine_handle<> h) {
+    return [this, h](const std::shared_future<typename C::mapped_type>& f) {
+      try {
+        value_ = f.get();
+      } catch (...) {
+        error_ = std::current_exception();
+      }
+      h.resume();
+    };
+  }
+  void rethrow() {
+    if (error_) {
+      std::rethrow_exception(error_);
+    }
+  }
+
+  C& cache_;
+  typename C::key_type key_;
+  std::optional<typename C::mapped_type> value_;
+  std::exception_ptr error_;
+};
+
+template <class C>
+class GetAwaiter : public AwaitBase<C> {
+ public:
+  GetAwaiter(C& cache, const typename C::key_type& k)
+      : AwaitBase<C>(cache, k) {}
+
+  bool await_ready() { return false; }
+  bool await_suspend(std::coroutine_handle<> h) {
+    typename C::mapped_type v;
+    const LoadState state =
+        this->cache_.beginLoad(this->key_, v, this->resumeWith(h), false);
+    if (state == LoadState::kWait) {
+      // h may already be running on the loading thread, don't touch this
+      return true;
+    }
+    if (state == LoadState::kHit) {
+      this->value_ = std::move(v);
+    }
+    return false;
+  }
+  std::optional<typename C::mapped_type> await_resume() {
+    this->rethrow();
+    return std::move(this->value_);
+  }
+};
+
+template <class C, class Loader>
+class LoadAwaiter : public AwaitBase<C> {
+ public:
+  typedef typename C::mapped_type Value;
+  typedef decltype(std::declval<Loader&>()(
+      std::declval<const typename C::key_type&>())) load_result;
+  // a loader returning Value runs inline, anything else is co_awaited
+  static const bool kAsyncLoader =
+      !std::is_convertible<load_result, Value>::value;
+
+  LoadAwaiter(C& cache, const typename C::key_type& k, Loader loader)
+      : AwaitBase<C>(cache, k), loader_(std::move(loader)) {}
+
+  bool await_ready() { return false; }
+  bool await_suspend(std::coroutine_handle<> h) {
+    Value v;
+    const LoadState state =
+        this->cache_.beginLoad(this->key_, v, this->resumeWith(h));
+    if (state == LoadState::kWait) {
+      return true;
+    }
+    if (state == LoadState::kHit) {
+      this->value_ = std::move(v);
+      return false;
+    }
+    if constexpr (kAsyncLoader) {
+      load(this->cache_, this->key_, loader_, this, h);
+      return true;
+    } else {
+      try {
+        this->value_ = loader_(this->key_);
+        this->cache_.endLoad(this->key_, *this->value_);
+      } catch (...) {
+        this->error_ = std::current_exception();
+        this->cache_.failLoad(this->key_, this->error_);
+      }
+      return false;
+    }
+  }
+  Value await_resume() {
+    this->rethrow();
+    return std::move(*this->value_);
+  }
+
+ private:
+  // the parameters are copies: self (and the key and loader in it) may be
+  // gone once h is resumed
+  static Detached load(C& cache, typename C::key_type k, Loader loader,
+                       LoadAwaiter* self, std::coroutine_handle<> h) {
+    std::exception_ptr error;
+    try {
+      Value v = co_await loader(k);
+      cache.endLoad(k, v);
+      self->value_ = std::move(v);
+    } catch (...) {
+      error = std::current_exception();
+    }
+    if (error) {
+      cache.failLoad(k, error);
+      self->error_ = error;
+    }
+    h.resume();
+  }
+
+  Loader loader_;
+};
+}  // namespace detail
+
+/**
+ *	co_await getAsync(cache, k) yields the value of k as a std::optional: a
+ *hit completes inline, a miss while another caller is loading k suspends
+ *until that load ends, any other miss yields std::nullopt.
+ *
+ *	co_await getOrLoadAsync(cache, k, loader) yields the value of k, loading
+ *it with loader(k) on a miss. concurrent misses, blocking getOrLoad() ones
+ *included, share a single load. loader(k) may return the Value (it then
+ *runs inline) or an awaitable of it, such as the caller's own task type,
+ *which is co_awaited without blocking. a failed load is rethrown to every
+ *caller waiting on it.
+ *
+ *	A suspended caller is resumed on the thread that finished the load,
+ *after the cache lock is released; co_await your executor afterwards if
+ *the coroutine must continue elsewhere. The cache lock itself is only held
+ *for the map and list bookkeeping, never across a load. Works with Cache
+ *and ShardedCache; key and loader are copied into the awaiter.
+ */
+template <class C>
+detail::GetAwaiter<C> getAsync(C& cache, const typename C::key_type& k) {
+  return detail::GetAwaiter<C>(cache, k);
+}
+template <class C, class Loader>
+detail::LoadAwaiter<C, typename std::decay<Loader>::type> getOrLoadAsync(
+    C& cache, const typename C::key_type& k, Loader&& loader) {
+  return detail::LoadAwaiter<C, typename std::decay<Loader>::type>(
+      cache, k, std::forward<Loader>(loader));
+}
+
+}  // namespace lru11
@@ -0,0 +1,628 @@
+/*
+ * LRUCache11 - a templated C++11 based LRU cache class that allows
+ * specification of
+ * key, value and optionally the map container type (defaults to
+ * std::unordered_map)
+ *
+ * LRUCache11BTree.hpp - lru11::BTreeMap, an ordered Map for lru11::Cache.
+ * A B+ tree with the entries stored inline in ~512 byte leaves and the
+ * separator keys inline in the inner nodes, so a lookup touches a few
+ * contiguous nodes instead of one red-black node per level, and range
+ * invalidation (Cache::removeRange() / removePrefix()) walks adjacent
+ * leaves.
+ *
+ * Github: https://github.com/mohaps/lrucache11
+ *
+ * Copyright (c) 2012-22 SAURAV MOHAPATRA <mohaps@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#pragma once
+#include <iterator>
+#include <tuple>
+
+#include "LRUCache11.hpp"
+
+namespace lru11 {
+
+namespace detail {
+// slots of a B tree node holding entries of the given size: ~512 bytes,
+// between 4 and 64 entries
+constexpr size_t btreeSlots(size_t each) {
+  return 512 / each < 4 ? 4 : (512 / each > 64 ? 64 : 512 / each);
+}
+}  // namespace detail
+
+/**
+ *	BTreeMap is an ordered map with the subset of the std::map interface
+ *that lru11::Cache uses (find, lower_bound, try_emplace, erase by key /
+ *iterator / range, forward iteration), for use as the Cache Map:
+ *
+ *		lru11::Cache<std::string, Row, std::mutex,
+ *		             lru11::BTreeMap<std::string, Row>> cache;
+ *
+ *	Unlike std::map, entries live in arrays that shift on insert and
+ *erase, so every insert or erase invalidates all iterators and references,
+ *and value_type is std::pair<Key, T> (do not change a key through an
+ *iterator). A node that drops under a quarter full is merged with a
+ *sibling when the two fit in one node and otherwise takes an entry from
+ *one, so no node but the root is ever empty. An insert allocates the
+ *nodes it needs before changing anything, so a bad_alloc leaves the map as
+ *it was.
+ */
+template <class Key, class T, class Compare = std::less<Key>,
+          class Allocator = std::allocator<std::pair<const Key, T>>>
+class BTreeMap {
+ public:
+  typedef Key key_type;
+  typedef T mapped_type;
+  typedef std::pair<Key, T> value_type;
+  typedef Compare key_compare;
+  typedef Allocator allocator_type;
+  typedef size_t size_type;
+
+ private:
+  static const size_t kLeafSlots = detail::btreeSlots(sizeof(value_type));
+  static const size_t kInnerSlots =
+      detail::btreeSlots(sizeof(Key) + sizeof(void*));
+  // 4^kMaxDepth entries is out of reach
+  enum { kMaxDepth = 32 };
+
+  struct Inner;
+  struct Node {
+    explicit Node(bool isLeaf) : leaf(isLeaf), count(0), parent(nullptr) {}
+    bool leaf;
+    // entries of a leaf, keys of an inner node (which has count + 1 children)
+    size_t count;
+    Inner* parent;
+  };
+  // one spare slot, so a node can be split right after it overflows
+  struct Leaf : Node {
+    Leaf() : Node(true), next(nullptr) {}
+    value_type* slots() { return reinterpret_cast<value_type*>(&storage); }
+    Leaf* next;
+    typename std::aligned_storage<sizeof(value_type) * (kLeafSlots + 1),
+                                  alignof(value_type)>::type storage;
+  };
+  // child[i] holds the keys below keys()[i], child[i + 1] the others
+  struct Inner : Node {
+    Inner() : Node(false) {}
+    Key* keys() { return reinterpret_cast<Key*>(&storage); }
+    typename std::aligned_storage<sizeof(Key) * (kInnerSlots + 1),
+                                  alignof(Key)>::type storage;
+    Node* child[kInnerSlots + 2];
+  };
+  typedef
+      typename std::allocator_traits<Allocator>::template rebind_alloc<Leaf>
+          leaf_alloc;
+  typedef
+      typename std::allocator_traits<Allocator>::template rebind_alloc<Inner>
+          inner_alloc;
+
+  template <class V>
+  class basic_iterator {
+   public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef typename std::remove_const<V>::type value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef V* pointer;
+    typedef V& reference;
+
+    basic_iterator() : leaf_(nullptr), pos_(0) {}
+    // iterator -> const_iterator
+    template <class U, class = typename std::enable_if<
+                           std::is_same<const U, V>::value>::type>
+    basic_iterator(const basic_iterator<U>& o)
+        : leaf_(o.leaf_), pos_(o.pos_) {}
+
+    reference operator*() const { return leaf_->slots()[pos_]; }
+    pointer operator->() const { return leaf_->slots() + pos_; }
+    basic_iterator& operator++() {
+      if (++pos_ == leaf_->count) {
+        leaf_ = leaf_->next;
+        pos_ = 0;
+      }
+      return *this;
+    }
+    basic_iterator operator++(int) {
+      basic_iterator old = *this;
+      ++*this;
+      return old;
+    }
+    bool operator==(const basic_iterator& o) const {
+      return leaf_ == o.leaf_ && pos_ == o.pos_;
+    }
+    bool operator!=(const basic_iterator& o) const { return !(*this == o); }
+
+   private:
+    friend class BTreeMap;
+    template <class>
+    friend class basic_iterator;
+    // (leaf, leaf->count) is moved on to the next leaf, or end()
+    basic_iterator(Leaf* leaf, size_t pos) : leaf_(leaf), pos_(pos) {
+      if (leaf_ != nullptr && pos_ == leaf_->count) {
+        leaf_ = leaf_->next;
+        pos_ = 0;
+      }
+    }
+    Leaf* leaf_;
+    size_t pos_;
+  };
+
+ public:
+  typedef basic_iterator<value_type> iterator;
+  typedef basic_iterator<const value_type> const_iterator;
+
+  explicit BTreeMap(const Compare& comp = Compare(),
+                    const Allocator& alloc = Allocator())
+      : root_(nullptr), size_(0), comp_(comp), alloc_(alloc) {}
+  explicit BTreeMap(const Allocator& alloc)
+      : root_(nullptr), size_(0), comp_(), alloc_(alloc) {}
+  BTreeMap(BTreeMap&& o)
+      : root_(o.root_), size_(o.size_), comp_(o.comp_), alloc_(o.alloc_) {
+    o.root_ = nullptr;
+    o.size_ = 0;
+  }
+  BTreeMap& operator=(BTreeMap&& o) {
+    if (this != &o) {
+      clear();
+      std::swap(root_, o.root_);
+      std::swap(size_, o.size_);
+      comp_ = o.comp_;
+      alloc_ = o.alloc_;
+    }
+    return *this;
+  }
+  ~BTreeMap() { clear(); }
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  void clear() {
+    if (root_ != nullptr) {
+      destroy(root_);
+      root_ = nullptr;
+      size_ = 0;
+    }
+  }
+  key_compare key_comp() const { return comp_; }
+  allocator_type get_allocator() const { return alloc_; }
+
+  iterator begin() { return iterator(leftmost(), 0); }
+  iterator end() { return iterator(); }
+  const_iterator begin() const { return const_iterator(leftmost(), 0); }
+  const_iterator end() const { return const_iterator(); }
+
+  template <class K>
+  iterator find(const K& k) {
+    if (root_ == nullptr) {
+      return end();
+    }
+    Leaf* leaf = descend(k);
+    const size_t pos = lowerPos(leaf, k);
+    if (pos == leaf->count || comp_(k, leaf->slots()[pos].first)) {
+      return end();
+    }
+    return iterator(leaf, pos);
+  }
+  template <class K>
+  const_iterator find(const K& k) const {
+    return const_cast<BTreeMap*>(this)->find(k);
+  }
+  // the first entry not below k
+  template <class K>
+  iterator lower_bound(const K& k) {
+    if (root_ == nullptr) {
+      return end();
+    }
+    Leaf* leaf = descend(k);
+    return iterator(leaf, lowerPos(leaf, k));
+  }
+  template <class K>
+  const_iterator lower_bound(const K& k) const {
+    return const_cast<BTreeMap*>(this)->lower_bound(k);
+  }
+
+  template <class... Args>
+  std::pair<iterator, bool> try_emplace(const Key& k, Args&&... args) {
+    if (root_ == nullptr) {
+      root_ = newLeaf();
+    }
+    Leaf* leaf = descend(k);
+    const size_t pos = lowerPos(leaf, k);
+    if (pos < leaf->count && !comp_(k, leaf->slots()[pos].first)) {
+      return std::make_pair(iterator(leaf, pos), false);
+    }
+    value_type v(std::piecewise_construct, std::forward_as_tuple(k),
+                 std::forward_as_tuple(std::forward<Args>(args)...));
+    Spares spares(*this);
+    if (leaf->count == kLeafSlots) {
+      spares.reserve(leaf);
+    }
+    insertAt(leaf->slots(), leaf->count, pos, std::move(v));
+    ++leaf->count;
+    ++size_;
+    if (leaf->count <= kLeafSlots) {
+      return std::make_pair(iterator(leaf, pos), true);
+    }
+    return std::make_pair(splitLeaf(leaf, pos, spares), true);
+  }
+  std::pair<iterator, bool> emplace(const Key& k, const T& v) {
+    return try_emplace(k, v);
+  }
+  std::pair<iterator, bool> insert(const value_type& v) {
+    return try_emplace(v.first, v.second);
+  }
+
+  // returns the entry after it
+  iterator erase(iterator it) {
+    Leaf* leaf = it.leaf_;
+    size_t pos = it.pos_;
+    eraseAt(leaf->slots(), leaf->count, pos);
+    --leaf->count;
+    --size_;
+    if (leaf->parent == nullptr) {
+      if (leaf->count == 0) {
+        freeLeaf(leaf);
+        root_ = nullptr;
+        return end();
+      }
+    } else if (leaf->count < kLeafSlots / 4) {
+      rebalance(leaf, pos);
+    }
+    return iterator(leaf, pos);
+  }
+  iterator erase(iterator first, iterator last) {
+    // erase() moves entries between leaves, so count rather than compare
+    size_t n = static_cast<size_t>(std::distance(first, last));
+    while (n-- != 0) {
+      first = erase(first);
+    }
+    return first;
+  }
+  template <class K>
+  size_t erase(const K& k) {
+    const iterator it = find(k);
+    if (it == end()) {
+      return 0;
+    }
+    erase(it);
+    return 1;
+  }
+
+ private:
+  BTreeMap(const BTreeMap&) = delete;
+  BTreeMap& operator=(const BTreeMap&) = delete;
+
+  // the nodes an insert may need, allocated before the tree is touched
+  class Spares {
+   public:
+    explicit Spares(BTreeMap& m) : m_(m), leaf_(nullptr), n_(0), used_(0) {}
+    ~Spares() {
+      if (leaf_ != nullptr) {
+        m_.freeLeaf(leaf_);
+      }
+      while (used_ < n_) {
+        m_.freeInner(inner_[used_++]);
+      }
+    }
+    // a split of the full leaf and of every full inner node above it
+    void reserve(Leaf* full) {
+      leaf_ = m_.newLeaf();
+      for (Inner* p = full->parent;; p = p->parent) {
+        if (p != nullptr && p->count < kInnerSlots) {
+          break;  // takes the separator without splitting
+        }
+        // p splits, or the root does and a new root is needed
+        Inner* in = m_.newInner();
+        inner_[n_++] = in;
+        if (p == nullptr) {
+          break;
+        }
+      }
+    }
+    Leaf* leaf() {
+      Leaf* l = leaf_;
+      leaf_ = nullptr;
+      return l;
+    }
+    Inner* inner() { return inner_[used_++]; }
+
+   private:
+    BTreeMap& m_;
+    Leaf* leaf_;
+    Inner* inner_[kMaxDepth];
+    size_t n_;
+    size_t used_;
+  };
+
+  template <class U>
+  static void insertAt(U* a, size_t n, size_t pos, U&& v) {
+    if (pos == n) {
+      ::new (a + n) U(std::move(v));
+      return;
+    }
+    ::new (a + n) U(std::move(a[n - 1]));
+    std::move_backward(a + pos, a + n - 1, a + n);
+    a[pos] = std::move(v);
+  }
+  template <class U>
+  static void eraseAt(U* a, size_t n, size_t pos) {
+    std::move(a + pos + 1, a + n, a + pos);
+    a[n - 1].~U();
+  }
+  // move constructs src[from, to) into dst and destroys the sources
+  template <class U>
+  static void moveOut(U* src, size_t from, size_t to, U* dst) {
+    for (size_t i = from; i < to; ++i) {
+      ::new (dst + (i - from)) U(std::move(src[i]));
+      src[i].~U();
+    }
+  }
+
+  template <class K>
+  Leaf* descend(const K& k) const {
+    Node* n = root_;
+    while (!n->leaf) {
+      Inner* in = static_cast<Inner*>(n);
+      const Key* keys = in->keys();
+      const Compare& comp = comp_;
+      const size_t i = static_cast<size_t>(
+          std::upper_bound(keys, keys + in->count, k,
+                           [&comp](const K& a, const Key& b) {
+                             return comp(a, b);
+                           }) -
+          keys);
+      n = in->child[i];
+    }
+    return static_cast<Leaf*>(n);
+  }
+  template <class K>
+  size_t lowerPos(Leaf* leaf, const K& k) const {
+    const value_type* slots = leaf->slots();
+    const Compare& comp = comp_;
+    return static_cast<size_t>(
+        std::lower_bound(slots, slots + leaf->count, k,
+                         [&comp](const value_type& a, const K& b) {
+                           return comp(a.first, b);
+                         }) -
+        slots);
+  }
+  Leaf* leftmost() const {
+    Node* n = root_;
+    while (n != nullptr && !n->leaf) {
+      n = static_cast<Inner*>(n)->child[0];
+    }
+    return static_cast<Leaf*>(n);
+  }
+  static size_t childIndex(const Inner* p, const Node* n) {
+    size_t i = 0;
+    while (p->child[i] != n) {
+      ++i;
+    }
+    return i;
+  }
+
+  // splits an overflowing leaf, returns where the entry at pos went
+  iterator splitLeaf(Leaf* leaf, size_t pos, Spares& spares) {
+    Leaf* right = spares.leaf();
+    const size_t half = leaf->count / 2;
+    moveOut(leaf->slots(), half, leaf->count, right->slots());
+    right->count = leaf->count - half;
+    leaf->count = half;
+    right->next = leaf->next;
+    leaf->next = right;
+    insertInParent(leaf, Key(right->slots()[0].first), right, spares);
+    return pos < half ? iterator(leaf, pos) : iterator(right, pos - half);
+  }
+  void insertInParent(Node* left, Key&& sep, Node* right, Spares& spares) {
+    Inner* p = left->parent;
+    if (p == nullptr) {
+      Inner* root = spares.inner();
+      ::new (root->keys()) Key(std::move(sep));
+      root->child[0] = left;
+      root->child[1] = right;
+      root->count = 1;
+      left->parent = right->parent = root;
+      root_ = root;
+      return;
+    }
+    const size_t c = childIndex(p, left);
+    insertAt(p->keys(), p->count, c, std::move(sep));
+    for (size_t i = p->count + 1; i > c + 1; --i) {
+      p->child[i] = p->child[i - 1];
+    }
+    p->child[c + 1] = right;
+    right->parent = p;
+    if (++p->count <= kInnerSlots) {
+      return;
+    }
+    // keys (mid, count) and their children go right, keys[mid] goes up
+    Inner* r = spares.inner();
+    const size_t mid = p->count / 2;
+    moveOut(p->keys(), mid + 1, p->count, r->keys());
+    r->count = p->count - mid - 1;
+    for (size_t i = 0; i <= r->count; ++i) {
+      r->child[i] = p->child[mid + 1 + i];
+      r->child[i]->parent = r;
+    }
+    Key up(std::move(p->keys()[mid]));
+    p->keys()[mid].~Key();
+    p->count = mid;
+    insertInParent(p, std::move(up), r, spares);
+  }
+
+  // merges an underfull leaf with a sibling, or takes an entry from one
+  // that is too full to merge with, keeping (leaf, pos) on the same entry
+  void rebalance(Leaf*& leaf, size_t& pos) {
+    Inner* p = leaf->parent;
+    const size_t c = childIndex(p, leaf);
+    Leaf* r = c < p->count ? static_cast<Leaf*>(p->child[c + 1]) : nullptr;
+    Leaf* l = c > 0 ? static_cast<Leaf*>(p->child[c - 1]) : nullptr;
+    if (r != nullptr && leaf->count + r->count <= kLeafSlots) {
+      mergeLeaves(leaf, r);
+      removeChild(p, c);
+      fixInner(p);
+    } else if (l != nullptr && l->count + leaf->count <= kLeafSlots) {
+      pos += l->count;
+      mergeLeaves(l, leaf);
+      leaf = l;
+      removeChild(p, c - 1);
+      fixInner(p);
+    } else if (r != nullptr) {
+      // r's first entry moves to the end of leaf, where (leaf, count) is
+      insertAt(leaf->slots(), leaf->count, leaf->count,
+               std::move(r->slots()[0]));
+      ++leaf->count;
+      eraseAt(r->slots(), r->count, 0);
+      --r->count;
+      p->keys()[c] = Key(r->slots()[0].first);
+    } else {
+      insertAt(leaf->slots(), leaf->count, 0,
+               std::move(l->slots()[l->count - 1]));
+      ++leaf->count;
+      ++pos;
+      l->slots()[--l->count].~value_type();
+      p->keys()[c - 1] = Key(leaf->slots()[0].first);
+    }
+  }
+  void mergeLeaves(Leaf* l, Leaf* r) {
+    moveOut(r->slots(), 0, r->count, l->slots() + l->count);
+    l->count += r->count;
+    r->count = 0;
+    l->next = r->next;
+    freeLeaf(r);
+  }
+  // drops key i and child i + 1 (already merged into child i)
+  static void removeChild(Inner* p, size_t i) {
+    eraseAt(p->keys(), p->count, i);
+    for (size_t j = i + 1; j < p->count; ++j) {
+      p->child[j] = p->child[j + 1];
+    }
+    --p->count;
+  }
+  void fixInner(Inner* p) {
+    Inner* g = p->parent;
+    if (g == nullptr) {
+      if (p->count == 0) {
+        root_ = p->child[0];
+        root_->parent = nullptr;
+        freeInner(p);
+      }
+      return;
+    }
+    if (p->count >= kInnerSlots / 4) {
+      return;
+    }
+    const size_t c = childIndex(g, p);
+    Inner* r = c < g->count ? static_cast<Inner*>(g->child[c + 1]) : nullptr;
+    Inner* l = c > 0 ? static_cast<Inner*>(g->child[c - 1]) : nullptr;
+    if (r != nullptr && p->count + 1 + r->count <= kInnerSlots) {
+      mergeInner(p, g->keys()[c], r);
+      removeChild(g, c);
+      fixInner(g);
+    } else if (l != nullptr && l->count + 1 + p->count <= kInnerSlots) {
+      mergeInner(l, g->keys()[c - 1], p);
+      removeChild(g, c - 1);
+      fixInner(g);
+    } else if (r != nullptr) {
+      // the separator comes down to p, r's first key goes up
+      insertAt(p->keys(), p->count, p->count, std::move(g->keys()[c]));
+      p->child[p->count + 1] = r->child[0];
+      r->child[0]->parent = p;
+      ++p->count;
+      g->keys()[c] = std::move(r->keys()[0]);
+      eraseAt(r->keys(), r->count, 0);
+      for (size_t i = 0; i < r->count; ++i) {
+        r->child[i] = r->child[i + 1];
+      }
+      --r->count;
+    } else {
+      insertAt(p->keys(), p->count, 0, std::move(g->keys()[c - 1]));
+      for (size_t i = p->count + 1; i > 0; --i) {
+        p->child[i] = p->child[i - 1];
+      }
+      p->child[0] = l->child[l->count];
+      p->child[0]->parent = p;
+      ++p->count;
+      g->keys()[c - 1] = std::move(l->keys()[l->count - 1]);
+      l->keys()[--l->count].~Key();
+    }
+  }
+  // appends the separator and r's keys and children to l, frees r
+  void mergeInner(Inner* l, Key& sep, Inner* r) {
+    ::new (l->keys() + l->count) Key(std::move(sep));
+    moveOut(r->keys(), 0, r->count, l->keys() + l->count + 1);
+    for (size_t i = 0; i <= r->count; ++i) {
+      l->child[l->count + 1 + i] = r->child[i];
+      r->child[i]->parent = l;
+    }
+    l->count += 1 + r->count;
+    r->count = 0;
+    freeInner(r);
+  }
+
+  Leaf* newLeaf() {
+    leaf_alloc a(alloc_);
+    Leaf* l = std::allocator_traits<leaf_alloc>::allocate(a, 1);
+    return ::new (l) Leaf();
+  }
+  Inner* newInner() {
+    inner_alloc a(alloc_);
+    Inner* in = std::allocator_traits<inner_alloc>::allocate(a, 1);
+    return ::new (in) Inner();
+  }
+  void freeLeaf(Leaf* l) {
+    for (size_t i = 0; i < l->count; ++i) {
+      l->slots()[i].~value_type();
+    }
+    l->~Leaf();
+    leaf_alloc a(alloc_);
+    std::allocator_traits<leaf_alloc>::deallocate(a, l, 1);
+  }
+  void freeInner(Inner* in) {
+    for (size_t i = 0; i < in->count; ++i) {
+      in->keys()[i].~Key();
+    }
+    in->~Inner();
+    inner_alloc a(alloc_);
+    std::allocator_traits<inner_alloc>::deallocate(a, in, 1);
+  }
+  void destroy(Node* n) {
+    if (n->leaf) {
+      freeLeaf(static_cast<Leaf*>(n));
+      return;
+    }
+    Inner* in = static_cast<Inner*>(n);
+    for (size_t i = 0; i <= in->count; ++i) {
+      destroy(in->child[i]);
+    }
+    freeInner(in);
+  }
+
+  Node* root_;
+  size_t size_;
+  Compare comp_;
+  Allocator alloc_;
+};
+
+namespace detail {
+template <class K, class T, class C, class A, class It, class Alloc>
+struct RebindMap<BTreeMap<K, T, C, A>, It, Alloc> {
+  typedef BTreeMap<K, It, C,
+                   typename RebindAlloc<A, Alloc, std::pair<const K, It>>::type>
+      type;
+  static const bool kRebound = !std::is_void<Alloc>::value;
+};
+}  // namespace detail
+
+}  // namespace lru11
@@ -0,0 +1,588 @@
+/*
+ * LRUCache11 - a templated C++11 based LRU cache class that allows
+ * specification of
+ * key, value and optionally the map container type (defaults to
+ * std::unordered_map)
+ *
+ * LRUCache11Compact.hpp - a storage mode for small trivially copyable keys
+ * and values. Keys, values and the LRU links are kept in separate arrays
+ * (struct of arrays) linked by 32 bit indices and indexed by a FlatIndex, so
+ * an entry of a CompactCache<uint64_t, uint32_t> takes ~30 bytes instead of
+ * the ~80 of a std::list node plus a std::unordered_map node. InlineString
+ * stores short string keys inline.
+ *
+ * Github: https://github.com/mohaps/lrucache11
+ *
+ * Copyright (c) 2012-22 SAURAV MOHAPATRA <mohaps@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#pragma once
+#include <cstring>
+#include <string>
+
+#include "LRUCache11Pooled.hpp"
+
+namespace lru11 {
+
+/**
+ *	A string of at most N chars stored inline, small-string style: the
+ *chars, zero padded, then the length in the last byte. It is trivially
+ *copyable, so it can be a CompactCache key, and compares as one block of
+ *N + 1 bytes. Longer strings throw std::length_error.
+ */
+template <size_t N>
+class InlineString {
+  static_assert(N > 0 && N < 256, "InlineString holds 1..255 chars");
+
+ public:
+  InlineString() { std::memset(data_, 0, sizeof(data_)); }
+  InlineString(const char* p, size_t n) {
+    if (n > N) {
+      throw std::length_error("inline_string_too_long");
+    }
+    std::memset(data_, 0, sizeof(data_));
+    std::memcpy(data_, p, n);
+    data_[N] = static_cast<char>(n);
+  }
+  InlineString(const char* s) : InlineString(s, std::strlen(s)) {}
+  InlineString(const std::string& s) : InlineString(s.data(), s.size()) {}
+
+  const char* data() const { return data_; }
+  size_t size() const { return static_cast<unsigned char>(data_[N]); }
+  bool empty() const { return size() == 0; }
+  std::string str() const { return std::string(data_, size()); }
+
+  bool operator==(const InlineString& o) const {
+    return std::memcmp(data_, o.data_, sizeof(data_)) == 0;
+  }
+  bool operator!=(const InlineString& o) const { return !(*this == o); }
+  bool operator<(const InlineString& o) const {
+    const int c = std::memcmp(data_, o.data_, N);
+    return c < 0 || (c == 0 && size() < o.size());
+  }
+
+ private:
+  char data_[N + 1];
+};
+
+namespace detail {
+// FNV-1a, the index mixes the result again
+inline uint64_t hashBytes(const char* p, size_t n) {
+  uint64_t h = 14695981039346656037ull;
+  for (size_t i = 0; i < n; ++i) {
+    h = (h ^ static_cast<unsigned char>(p[i])) * 1099511628211ull;
+  }
+  return h;
+}
+}  // namespace detail
+
+/**
+ *	A cache with the API and the maxSize/elasticity semantics of
+ *PooledCache for trivially copyable Key and Value types (integers, PODs,
+ *InlineString). One pool of getMaxAllowedSize() entries is allocated up
+ *front as separate key, value, prev and next arrays: the links are 32 bit
+ *indices and nothing is padded to the alignment of a combined node, and
+ *prune() only walks the 8 byte link records and the keys it unindexes.
+ *
+ *		Hash / KeyEqual - used by the FlatIndex
+ *
+ *	getRef() and cwalk() cannot hand out a node, so getRef() returns the
+ *value slot and cwalk() passes f a KeyValuePair copy. Values are taken by
+ *const reference (there is nothing to move), and emplace() constructs the
+ *Value from its args and copies it in.
+ */
+template <class Key, class Value, class Lock = NullLock,
+          class Hash = std::hash<Key>, class KeyEqual = std::equal_to<Key>>
+class CompactCache {
+  static_assert(std::is_trivially_copyable<Key>::value &&
+                    std::is_trivially_copyable<Value>::value,
+                "CompactCache needs trivially copyable keys and values");
+
+ public:
+  typedef KeyValuePair<Key, Value> node_type;
+  typedef FlatIndex<Key, Hash, KeyEqual> key_index_type;
+  typedef Lock lock_type;
+  using Guard = std::lock_guard<lock_type>;
+  using ProbeGuard = detail::SharedGuard<lock_type>;
+  typedef uint32_t index_type;
+  static const index_type kNil = detail::kNilIndex;
+  // enables the heterogeneous lookup overloads for non-Key lookup types
+  template <class K>
+  using EnableTransparent = typename std::enable_if<
+      detail::has_is_transparent<Hash>::value &&
+      detail::has_is_transparent<KeyEqual>::value &&
+      !std::is_same<typename std::decay<K>::type, Key>::value>::type;
+
+  explicit CompactCache(size_t maxSize = 64, size_t elasticity = 10,
+                        const Hash& hash = Hash(),
+                        const KeyEqual& eq = KeyEqual())
+      : maxSize_(maxSize),
+        elasticity_(elasticity),
+        capacity_(maxSize + elasticity),
+        pruneBudget_(0),
+        draining_(false),
+        size_(0),
+        head_(kNil),
+        tail_(kNil),
+        free_(kNil),
+        index_(hash, eq) {
+    if (maxSize_ == 0) {
+      throw std::invalid_argument("compact_cache_requires_max_size");
+    }
+    if (capacity_ >= kNil) {
+      throw std::invalid_argument("compact_cache_too_large");
+    }
+    keys_.resize(capacity_);
+    values_.resize(capacity_);
+    links_.resize(capacity_);
+    for (size_t i = 0; i < capacity_; ++i) {
+      links_[i].next = (i + 1 < capacity_) ? index_type(i + 1) : kNil;
+    }
+    free_ = 0;
+    index_.init(capacity_);
+  }
+  virtual ~CompactCache() = default;
+
+  size_t size() const {
+    ProbeGuard g(lock_);
+    return size_;
+  }
+  bool empty() const {
+    ProbeGuard g(lock_);
+    return size_ == 0;
+  }
+  void clear() {
+    Guard g(lock_);
+    clear_nolock();
+  }
+  void insert(const Key& k, const Value& v) {
+    Guard g(lock_);
+    insert_nolock(k, v);
+  }
+  // same as insert(), true if k was added, false if it was overwritten
+  bool insert_or_assign(const Key& k, const Value& v) {
+    Guard g(lock_);
+    return insert_nolock(k, v);
+  }
+  /**
+   * constructs the value for k from args, if k is not cached yet. an
+   * existing entry is left untouched. returns true if k was added
+   */
+  template <class... Args>
+  bool emplace(const Key& k, Args&&... args) {
+    Guard g(lock_);
+    const size_t h = index_.hash(k);
+    if (index_.find(k, h, *this) != kNil) {
+      return false;
+    }
+    link_nolock(k, Value(std::forward<Args>(args)...), h);
+    return true;
+  }
+  /**
+   * batched lookup of keys[0..n) under one lock acquisition, see
+   * PooledCache::getMany()
+   */
+  template <class Keys>
+  size_t getMany(const Keys& keys, std::vector<Value>& values,
+                 std::vector<bool>& found) {
+    enum { kChunk = 16 };
+    size_t hashes[kChunk];
+    index_type hits[kChunk];
+    const size_t n = keys.size();
+    values.resize(n);
+    found.assign(n, false);
+    size_t count = 0;
+    Guard g(lock_);
+    for (size_t base = 0; base < n; base += kChunk) {
+      const size_t m = std::min<size_t>(n - base, kChunk);
+      for (size_t j = 0; j < m; ++j) {
+        hashes[j] = index_.hash(keys[base + j]);
+        index_.prefetch(hashes[j]);
+      }
+      for (size_t j = 0; j < m; ++j) {
+        hits[j] = index_.find(keys[base + j], hashes[j], *this);
+        if (hits[j] != kNil) {
+          detail::prefetch(&values_[hits[j]]);
+        }
+      }
+      for (size_t j = 0; j < m; ++j) {
+        if (hits[j] != kNil) {
+          moveToFront(hits[j]);
+          values[base + j] = values_[hits[j]];
+          found[base + j] = true;
+          ++count;
+        }
+      }
+    }
+    return count;
+  }
+  /**
+   * inserts every (key, value) pair of [first, last) under one lock
+   * acquisition
+   */
+  template <class It>
+  void insertMany(It first, It last) {
+    Guard g(lock_);
+    for (; first != last; ++first) {
+      insert_nolock((*first).first, (*first).second);
+    }
+  }
+  template <class Range>
+  void insertMany(const Range& items) {
+    insertMany(std::begin(items), std::end(items));
+  }
+  bool tryGet(const Key& kIn, Value& vOut) { return tryGetCopy(kIn, vOut); }
+  bool tryGetCopy(const Key& kIn, Value& vOut) {
+    Guard g(lock_);
+    return tryGetRef_nolock(kIn, vOut);
+  }
+  bool tryGetRef(const Key& kIn, Value& vOut) {
+    Guard g(lock_);
+    return tryGetRef_nolock(kIn, vOut);
+  }
+  // valid till the next insert/delete, as for Cache::getRef()
+  const Value& getRef(const Key& k) {
+    Guard g(lock_);
+    return values_[get_nolock(k)];
+  }
+  Value get(const Key& k) { return getCopy(k); }
+  Value getCopy(const Key& k) {
+    Guard g(lock_);
+    return values_[get_nolock(k)];
+  }
+  bool remove(const Key& k) {
+    Guard g(lock_);
+    return remove_nolock(k);
+  }
+  bool contains(const Key& k) const {
+    ProbeGuard g(lock_);
+    return find_nolock(k) != kNil;
+  }
+  // see Cache::peek(), no promotion
+  bool tryPeek(const Key& kIn, Value& vOut) const {
+    ProbeGuard g(lock_);
+    const index_type i = find_nolock(kIn);
+    if (i == kNil) {
+      return false;
+    }
+    vOut = values_[i];
+    return true;
+  }
+  Value peek(const Key& k) const {
+    ProbeGuard g(lock_);
+    return peek_nolock(k);
+  }
+  /**
+   *	heterogeneous lookups, enabled when both Hash and KeyEqual are
+   *transparent (declare is_transparent and accept the lookup type)
+   */
+  template <class K, class = EnableTransparent<K>>
+  bool tryGet(const K& kIn, Value& vOut) {
+    return tryGetCopy(kIn, vOut);
+  }
+  template <class K, class = EnableTransparent<K>>
+  bool tryGetCopy(const K& kIn, Value& vOut) {
+    Guard g(lock_);
+    return tryGetRef_nolock(kIn, vOut);
+  }
+  template <class K, class = EnableTransparent<K>>
+  bool tryGetRef(const K& kIn, Value& vOut) {
+    Guard g(lock_);
+    return tryGetRef_nolock(kIn, vOut);
+  }
+  template <class K, class = EnableTransparent<K>>
+  const Value& getRef(const K& k) {
+    Guard g(lock_);
+    return values_[get_nolock(k)];
+  }
+  template <class K, class = EnableTransparent<K>>
+  Value get(const K& k) {
+    return getCopy(k);
+  }
+  template <class K, class = EnableTransparent<K>>
+  Value getCopy(const K& k) {
+    Guard g(lock_);
+    return values_[get_nolock(k)];
+  }
+  template <class K, class = EnableTransparent<K>>
+  bool remove(const K& k) {
+    Guard g(lock_);
+    return remove_nolock(k);
+  }
+  template <class K, class = EnableTransparent<K>>
+  bool contains(const K& k) const {
+    ProbeGuard g(lock_);
+    return find_nolock(k) != kNil;
+  }
+  template <class K, class = EnableTransparent<K>>
+  bool tryPeek(const K& kIn, Value& vOut) const {
+    ProbeGuard g(lock_);
+    const index_type i = find_nolock(kIn);
+    if (i == kNil) {
+      return false;
+    }
+    vOut = values_[i];
+    return true;
+  }
+  template <class K, class = EnableTransparent<K>>
+  Value peek(const K& k) const {
+    ProbeGuard g(lock_);
+    return peek_nolock(k);
+  }
+
+  size_t getMaxSize() const { return maxSize_; }
+  size_t getElasticity() const { return elasticity_; }
+  size_t getMaxAllowedSize() const { return maxSize_ + elasticity_; }
+  // see Cache::setPruneBudget() and Cache::maintain()
+  void setPruneBudget(size_t budget) {
+    Guard g(lock_);
+    pruneBudget_ = budget;
+  }
+  size_t getPruneBudget() const {
+    ProbeGuard g(lock_);
+    return pruneBudget_;
+  }
+  size_t maintain(size_t budget) {
+    Guard g(lock_);
+    return trim_nolock(budget);
+  }
+  /**
+   * see PooledCache::checkInvariants()
+   */
+  bool checkInvariants() const {
+    Guard g(lock_);
+    size_t n = 0;
+    index_type prev = kNil;
+    for (index_type i = head_; i != kNil; prev = i, i = links_[i].next) {
+      if (links_[i].prev != prev || find_nolock(keys_[i]) != i ||
+          ++n > size_) {
+        return false;
+      }
+    }
+    if (prev != tail_ || n != size_) {
+      return false;
+    }
+    size_t free = 0;
+    for (index_type i = free_; i != kNil; i = links_[i].next) {
+      if (++free > capacity_) {
+        return false;
+      }
+    }
+    return n + free == capacity_ &&
+           (draining_ || size_ <= maxSize_ + elasticity_);
+  }
+  /**
+   * the bytes allocated for the whole pool and its index, for capacity
+   * planning (constant after construction)
+   */
+  size_t memoryUsage() const {
+    return capacity_ * (sizeof(Key) + sizeof(Value) + sizeof(Links)) +
+           index_.memoryUsage();
+  }
+  /**
+   * walks the entries in MRU -> LRU order, f gets a node_type copy
+   */
+  template <typename F>
+  void cwalk(F& f) const {
+    ProbeGuard g(lock_);
+    for (index_type i = head_; i != kNil; i = links_[i].next) {
+      const node_type n(keys_[i], values_[i]);
+      f(n);
+    }
+  }
+
+ protected:
+  template <class K>
+  index_type find_nolock(const K& k) const {
+    return index_.find(k, index_.hash(k), *this);
+  }
+  template <class K>
+  Value peek_nolock(const K& k) const {
+    const index_type i = find_nolock(k);
+    if (i == kNil) {
+      throw KeyNotFound();
+    }
+    return values_[i];
+  }
+  bool insert_nolock(const Key& k, const Value& v) {
+    const size_t h = index_.hash(k);
+    const index_type i = index_.find(k, h, *this);
+    if (i != kNil) {
+      values_[i] = v;
+      moveToFront(i);
+      return false;
+    }
+    link_nolock(k, v, h);
+    return true;
+  }
+  // stores an entry for a key that is not cached yet in a free slot
+  void link_nolock(const Key& k, const Value& v, size_t h) {
+    if (free_ == kNil) {
+      // only reachable with elasticity == 0, see PooledCache
+      evict(tail_);
+    }
+    const index_type i = free_;
+    free_ = links_[i].next;
+    keys_[i] = k;
+    values_[i] = v;
+    linkFront(i);
+    index_.insert(i, h, *this);
+    ++size_;
+    prune();
+  }
+  template <class K>
+  index_type get_nolock(const K& k) {
+    const index_type i = find_nolock(k);
+    if (i == kNil) {
+      throw KeyNotFound();
+    }
+    moveToFront(i);
+    return i;
+  }
+  template <class K>
+  bool tryGetRef_nolock(const K& kIn, Value& vOut) {
+    const index_type i = find_nolock(kIn);
+    if (i == kNil) {
+      return false;
+    }
+    moveToFront(i);
+    vOut = values_[i];
+    return true;
+  }
+  template <class K>
+  bool remove_nolock(const K& k) {
+    const index_type i = find_nolock(k);
+    if (i == kNil) {
+      return false;
+    }
+    evict(i);
+    return true;
+  }
+  size_t prune() {
+    if (size_ >= maxSize_ + elasticity_) {
+      draining_ = true;
+    }
+    if (!draining_) {
+      return 0;
+    }
+    return trim_nolock(pruneBudget_ != 0 ? pruneBudget_ : size_);
+  }
+  // evicts up to budget entries over maxSize, the drain ends at maxSize
+  size_t trim_nolock(size_t budget) {
+    size_t count = 0;
+    while (count < budget && size_ > maxSize_) {
+      evict(tail_);
+      ++count;
+    }
+    if (size_ <= maxSize_) {
+      draining_ = false;
+    }
+    return count;
+  }
+
+ private:
+  friend key_index_type;
+  typedef typename key_index_type::hook index_hook;
+
+  struct Links {
+    index_type prev;
+    index_type next;
+  };
+
+  // node access for the index
+  const Key& key(index_type i) const { return keys_[i]; }
+
+  void linkFront(index_type i) {
+    links_[i].prev = kNil;
+    links_[i].next = head_;
+    if (head_ != kNil) {
+      links_[head_].prev = i;
+    } else {
+      tail_ = i;
+    }
+    head_ = i;
+  }
+  void unlink(index_type i) {
+    const Links l = links_[i];
+    if (l.prev != kNil) {
+      links_[l.prev].next = l.next;
+    } else {
+      head_ = l.next;
+    }
+    if (l.next != kNil) {
+      links_[l.next].prev = l.prev;
+    } else {
+      tail_ = l.prev;
+    }
+  }
+  void moveToFront(index_type i) {
+    if (i != head_) {
+      unlink(i);
+      linkFront(i);
+    }
+  }
+  void evict(index_type i) {
+    index_.erase(i, index_.hash(keys_[i]), *this);
+    unlink(i);
+    links_[i].next = free_;
+    free_ = i;
+    --size_;
+  }
+  void clear_nolock() {
+    for (index_type i = head_; i != kNil;) {
+      const index_type next = links_[i].next;
+      links_[i].next = free_;
+      free_ = i;
+      i = next;
+    }
+    head_ = tail_ = kNil;
+    size_ = 0;
+    index_.clear();
+  }
+
+  // Disallow copying.
+  CompactCache(const CompactCache&) = delete;
+  CompactCache& operator=(const CompactCache&) = delete;
+
+  mutable Lock lock_;
+  size_t maxSize_;
+  size_t elasticity_;
+  size_t capacity_;
+  size_t pruneBudget_;
+  // between reaching the hard limit and getting back to maxSize
+  bool draining_;
+  size_t size_;
+  index_type head_;
+  index_type tail_;
+  index_type free_;
+  std::vector<Key> keys_;
+  std::vector<Value> values_;
+  std::vector<Links> links_;
+  key_index_type index_;
+};
+
+template <class Key, class Value, class Lock, class Hash, class KeyEqual>
+const typename CompactCache<Key, Value, Lock, Hash, KeyEqual>::index_type
+    CompactCache<Key, Value, Lock, Hash, KeyEqual>::kNil;
+
+}  // namespace lru11
+
+namespace std {
+template <size_t N>
+struct hash<lru11::InlineString<N>> {
+  size_t operator()(const lru11::InlineString<N>& s) const {
+    return static_cast<size_t>(lru11::detail::hashBytes(s.data(), s.size()));
+  }
+};
+}  // namespace std
@@ -0,0 +1,338 @@
+/*
+ * LRUCache11 - a templated C++11 based LRU cache class that allows
+ * specification of
+ * key, value and optionally the map container type (defaults to
+ * std::unordered_map)
+ *
+ * LRUCache11Numa.hpp - a sharded cache split into groups, one per NUMA node
+ * (or core group). Each group owns its own lru11::ShardedCache, built with
+ * its own allocator instance, so threads of one socket only touch the locks
+ * and list / map nodes of their own socket. Entries a group evicts for size
+ * go to a victim tier shared by all groups and read under a shared lock.
+ *
+ * Github: https://github.com/mohaps/lrucache11
+ *
+ * Copyright (c) 2012-22 SAURAV MOHAPATRA <mohaps@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#pragma once
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "LRUCache11.hpp"
+
+#ifdef __linux__
+#include <sched.h>
+#define LRU11_HAVE_GETCPU 1
+#endif
+
+namespace lru11 {
+
+namespace detail {
+// "0-3,8-11" (the sysfs cpulist format) -> {0, 1, 2, 3, 8, 9, 10, 11}
+inline std::vector<size_t> parseCpuList(const char* s) {
+  std::vector<size_t> cpus;
+  while (*s != '\0' && *s != '\n') {
+    char* end = nullptr;
+    const size_t first = std::strtoul(s, &end, 10);
+    if (end == s) {
+      break;
+    }
+    size_t last = first;
+    s = end;
+    if (*s == '-') {
+      ++s;
+      last = std::strtoul(s, &end, 10);
+      s = end;
+    }
+    for (size_t c = first; c <= last; ++c) {
+      cpus.push_back(c);
+    }
+    if (*s == ',') {
+      ++s;
+    }
+  }
+  return cpus;
+}
+
+/**
+ * cpu -> NUMA node, read once from /sys/devices/system/node. empty when the
+ * topology is not available (not Linux, no sysfs), i.e. a single node.
+ */
+inline std::vector<size_t> cpuToNode() {
+  std::vector<size_t> table;
+#ifdef LRU11_HAVE_GETCPU
+  for (size_t node = 0;; ++node) {
+    const std::string path = "/sys/devices/system/node/node" +
+                             std::to_string(node) + "/cpulist";
+    std::FILE* f = std::fopen(path.c_str(), "r");
+    if (f == nullptr) {
+      break;
+    }
+    char line[4096];
+    const bool ok = std::fgets(line, sizeof(line), f) != nullptr;
+    std::fclose(f);
+    if (!ok) {
+      continue;
+    }
+    for (size_t cpu : parseCpuList(line)) {
+      if (cpu >= table.size()) {
+        table.resize(cpu + 1, 0);
+      }
+      table[cpu] = node;
+    }
+  }
+#endif
+  return table;
+}
+
+/**
+ * cpu -> group for groupCount groups over the cpu -> node table. with no
+ * more groups than nodes a node maps to group node % groupCount; with more,
+ * the groups are dealt out over the nodes that have cpus (the first ones
+ * get one extra when it doesn't divide) and each node's cpus are split
+ * into contiguous runs, in cpu order, so no group spans two nodes however
+ * the cpu ids are interleaved
+ */
+inline std::vector<size_t> cpuGroups(const std::vector<size_t>& cpuNode,
+                                     size_t groupCount) {
+  std::vector<std::vector<size_t>> nodeCpus;
+  for (size_t cpu = 0; cpu < cpuNode.size(); ++cpu) {
+    if (cpuNode[cpu] >= nodeCpus.size()) {
+      nodeCpus.resize(cpuNode[cpu] + 1);
+    }
+    nodeCpus[cpuNode[cpu]].push_back(cpu);
+  }
+  std::vector<size_t> groups(cpuNode.size(), 0);
+  if (groupCount <= nodeCpus.size()) {
+    for (size_t cpu = 0; cpu < cpuNode.size(); ++cpu) {
+      groups[cpu] = cpuNode[cpu] % groupCount;
+    }
+    return groups;
+  }
+  size_t used = 0;
+  for (const auto& cpus : nodeCpus) {
+    used += cpus.empty() ? 0 : 1;
+  }
+  size_t next = 0;
+  size_t seen = 0;
+  for (const auto& cpus : nodeCpus) {
+    if (cpus.empty()) {
+      continue;
+    }
+    const size_t share =
+        groupCount / used + (seen++ < groupCount % used ? 1 : 0);
+    for (size_t i = 0; i < cpus.size(); ++i) {
+      groups[cpus[i]] = next + i * share / cpus.size();
+    }
+    next += share;
+  }
+  return groups;
+}
+
+// the cpu this thread runs on (a vDSO call on Linux), -1 if unknown
+inline int currentCpu() {
+#ifdef LRU11_HAVE_GETCPU
+  return ::sched_getcpu();
+#else
+  return -1;
+#endif
+}
+}  // namespace detail
+
+/**
+ *	NumaShardedCache splits a cache into groups. By default a group is a
+ *NUMA node; asking for more groups than there are nodes splits the cpus
+ *of each node into core groups instead (see detail::cpuGroups()). The calling thread's group is found
+ *from the cpu it runs on (sched_getcpu()), or by thread id where that is
+ *not available; a custom groupOf functor can replace both.
+ *
+ *	A lookup checks the caller's own group, then the shared victim tier,
+ *then (peek only, no promotion) the other groups. A hit outside the own
+ *group is copied into it, so keys that are hot on several sockets end up
+ *replicated per socket and are read locally from then on. The victim tier
+ *receives every entry a group evicts for size and is a ClockPolicy
+ *ShardedCache: its hits only set a reference bit and, with a reader writer
+ *VictimLock (e.g. std::shared_timed_mutex), are served under a shared lock.
+ *
+ *	insert() and remove() are writes: they drop the key from the other
+ *groups and the victim tier, so a read after a completed write sees the
+ *new value on every socket. That makes writes cost one remote lock per
+ *group, which is the trade a read-mostly workload wants. A spill racing
+ *with a write to the same key can briefly leave the older value in the
+ *victim tier.
+ *
+ *		maxSize / elasticity - per group; every group is a ShardedCache of
+ *shardsPerGroup shards
+ *		victimSize - entries in the shared victim tier
+ *		allocatorFor - returns the allocator for a group's list and map
+ *nodes, e.g. a std::pmr resource bound to that node's memory (default:
+ *Allocator() for every group)
+ */
+template <class Key, class Value, class Lock = std::mutex,
+          class VictimLock = Lock,
+          class Hash = std::hash<Key>,
+          class Allocator = std::allocator<char>>
+class NumaShardedCache {
+ public:
+  typedef ShardedCache<Key, Value, Lock, std::unordered_map<Key, Value, Hash>,
+                       Hash, LRUPolicy, NoWeigher, NoExpiry, NoStats,
+                       Allocator>
+      group_type;
+  typedef ShardedCache<Key, Value, VictimLock,
+                       std::unordered_map<Key, Value, Hash>, Hash, ClockPolicy>
+      victim_type;
+
+  /**
+   * groupCount 0 uses one group per NUMA node found. the groups are
+   * constructed in order on the calling thread; pass allocators that place
+   * their memory explicitly rather than relying on first touch.
+   */
+  NumaShardedCache(size_t maxSize, size_t elasticity, size_t victimSize,
+                   size_t groupCount = 0, size_t shardsPerGroup = 8,
+                   std::function<Allocator(size_t)> allocatorFor = nullptr,
+                   std::function<size_t()> groupOf = nullptr)
+      : victim_(victimSize, victimSize / 10, shardsPerGroup),
+        groupOf_(std::move(groupOf)) {
+    const std::vector<size_t> cpuNode = detail::cpuToNode();
+    size_t nodes = 1;
+    for (size_t node : cpuNode) {
+      nodes = std::max(nodes, node + 1);
+    }
+    if (groupCount == 0) {
+      groupCount = nodes;
+    }
+    cpuGroup_ = detail::cpuGroups(cpuNode, groupCount);
+    groups_.reserve(groupCount);
+    for (size_t g = 0; g < groupCount; ++g) {
+      groups_.push_back(std::unique_ptr<group_type>(new group_type(
+          maxSize, elasticity, shardsPerGroup, 0, Hash(), NoWeigher(),
+          allocatorOf(allocatorFor, g,
+                      std::is_default_constructible<Allocator>()))));
+      victim_type* victim = &victim_;
+      groups_.back()->setRemovalListener(
+          [victim](const Key& k, Value& v, RemovalCause cause) {
+            if (cause == RemovalCause::kSize) {
+              victim->insert(k, std::move(v));
+            }
+          });
+    }
+  }
+  virtual ~NumaShardedCache() = default;
+
+  void insert(const Key& k, Value v) {
+    const size_t own = currentGroup();
+    for (size_t g = 0; g < groups_.size(); ++g) {
+      if (g != own) {
+        groups_[g]->remove(k);
+      }
+    }
+    victim_.remove(k);
+    groups_[own]->insert(k, std::move(v));
+  }
+  bool tryGet(const Key& k, Value& vOut) {
+    const size_t own = currentGroup();
+    if (groups_[own]->tryGet(k, vOut)) {
+      return true;
+    }
+    bool found = victim_.tryGet(k, vOut);
+    for (size_t g = 0; !found && g < groups_.size(); ++g) {
+      found = g != own && groups_[g]->tryPeek(k, vOut);
+    }
+    if (found && !groups_[own]->emplace(k, vOut)) {
+      groups_[own]->tryPeek(k, vOut);
+    }
+    return found;
+  }
+  Value get(const Key& k) {
+    Value v;
+    if (!tryGet(k, v)) {
+      throw KeyNotFound();
+    }
+    return v;
+  }
+  bool remove(const Key& k) {
+    bool removed = victim_.remove(k);
+    for (const auto& group : groups_) {
+      removed = group->remove(k) || removed;
+    }
+    return removed;
+  }
+  // in any group or the victim tier, promotes nothing
+  bool contains(const Key& k) const {
+    if (victim_.contains(k)) {
+      return true;
+    }
+    for (const auto& group : groups_) {
+      if (group->contains(k)) {
+        return true;
+      }
+    }
+    return false;
+  }
+  // entries held by the groups (a replicated key counts once per group)
+  size_t size() const {
+    size_t total = 0;
+    for (const auto& group : groups_) {
+      total += group->size();
+    }
+    return total;
+  }
+  size_t victimSize() const { return victim_.size(); }
+  void clear() {
+    for (const auto& group : groups_) {
+      group->clear();
+    }
+    victim_.clear();
+  }
+
+  size_t groupCount() const { return groups_.size(); }
+  // the group of the calling thread
+  size_t currentGroup() const {
+    if (groupOf_) {
+      return groupOf_() % groups_.size();
+    }
+    const int cpu = detail::currentCpu();
+    if (cpu >= 0 && static_cast<size_t>(cpu) < cpuGroup_.size()) {
+      return cpuGroup_[cpu];
+    }
+    return detail::threadStripe() % groups_.size();
+  }
+  group_type& group(size_t g) { return *groups_[g]; }
+  const group_type& group(size_t g) const { return *groups_[g]; }
+  victim_type& victim() { return victim_; }
+  const victim_type& victim() const { return victim_; }
+
+ private:
+  // allocatorFor is required when Allocator has no default constructor
+  static Allocator allocatorOf(const std::function<Allocator(size_t)>& f,
+                               size_t g, std::true_type) {
+    return f ? f(g) : Allocator();
+  }
+  static Allocator allocatorOf(const std::function<Allocator(size_t)>& f,
+                               size_t g, std::false_type) {
+    return f(g);
+  }
+
+  NumaShardedCache(const NumaShardedCache&) = delete;
+  NumaShardedCache& operator=(const NumaShardedCache&) = delete;
+
+  victim_type victim_;
+  std::vector<std::unique_ptr<group_type>> groups_;
+  std::vector<size_t> cpuGroup_;
+  std::function<size_t()> groupOf_;
+};
+
+}  // namespace lru11
@@ -0,0 +1,885 @@
+/*
+ * LRUCache11 - a templated C++11 based LRU cache class that allows
+ * specification of
+ * key, value and optionally the map container type (defaults to
+ * std::unordered_map)
+ *
+ * LRUCache11Pooled.hpp - an allocation-free storage mode for the cache.
+ * All nodes live in one preallocated pool and each node carries the key,
+ * the value, the LRU links and the hash-chain link, so an insert does no
+ * heap allocation and the key is only stored once.
+ *
+ * The key -> node index is pluggable: FlatIndex (default) is an
+ * open-addressing, swiss-table style table of control bytes and 32 bit node
+ * indices, ChainedIndex is a classic bucket array chained through the nodes.
+ *
+ * Github: https://github.com/mohaps/lrucache11
+ *
+ * Copyright (c) 2012-22 SAURAV MOHAPATRA <mohaps@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#pragma once
+#include <new>
+#include <type_traits>
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define LRU11_FLAT_INDEX_SSE2 1
+#endif
+
+#include "LRUCache11.hpp"
+
+namespace lru11 {
+
+namespace detail {
+static const uint32_t kNilIndex = 0xffffffffu;
+
+inline unsigned lowestBit(uint32_t m) {
+#if defined(__GNUC__) || defined(__clang__)
+  return static_cast<unsigned>(__builtin_ctz(m));
+#else
+  unsigned n = 0;
+  while ((m & 1u) == 0) {
+    m >>= 1;
+    ++n;
+  }
+  return n;
+#endif
+}
+
+/*
+ * a group of 16 control bytes probed at once. a control byte is either
+ * kEmpty, kDeleted or (for a full slot) the low 7 bits of the hash
+ */
+struct CtrlGroup {
+  enum : size_t { kWidth = 16 };
+  enum : int8_t { kEmpty = -128, kDeleted = -2 };
+
+#ifdef LRU11_FLAT_INDEX_SSE2
+  explicit CtrlGroup(const int8_t* p)
+      : ctrl(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))) {}
+  uint32_t match(int8_t h2) const {
+    return static_cast<uint32_t>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h2), ctrl)));
+  }
+  // empty and deleted are the only control bytes with the sign bit set
+  uint32_t matchEmptyOrDeleted() const {
+    return static_cast<uint32_t>(_mm_movemask_epi8(ctrl));
+  }
+  __m128i ctrl;
+#else
+  explicit CtrlGroup(const int8_t* p) : ctrl(p) {}
+  uint32_t match(int8_t h2) const {
+    uint32_t m = 0;
+    for (size_t i = 0; i < kWidth; ++i) {
+      m |= uint32_t(ctrl[i] == h2) << i;
+    }
+    return m;
+  }
+  uint32_t matchEmptyOrDeleted() const {
+    uint32_t m = 0;
+    for (size_t i = 0; i < kWidth; ++i) {
+      m |= uint32_t(ctrl[i] < 0) << i;
+    }
+    return m;
+  }
+  const int8_t* ctrl;
+#endif
+  uint32_t matchEmpty() const { return match(kEmpty); }
+};
+}  // namespace detail
+
+/**
+ *	Index concept used by PooledCache. An index maps keys to 32 bit node
+ *indices and reaches the keys through the cache's node storage. hash() and
+ *find() accept any type the Hash / KeyEqual accept, so transparent functors
+ *give heterogeneous lookups.
+ *
+ *		nodes.key(i)  - key stored in node i
+ *		nodes.hook(i) - the per-node index_hook (intrusive index data)
+ *
+ *	prefetch(h) hints where find(k, h) will start probing, so batched
+ *lookups can overlap their cache misses.
+ *memoryUsage() is the size of the table in bytes.
+ *
+ *	ChainedIndex - a power of two bucket array, collisions chained through
+ *the nodes (one extra index per node)
+ */
+template <class Key, class Hash = std::hash<Key>,
+          class KeyEqual = std::equal_to<Key>>
+class ChainedIndex {
+ public:
+  typedef uint32_t index_type;
+  struct hook {
+    index_type chain;
+  };
+
+  explicit ChainedIndex(const Hash& hash = Hash(), const KeyEqual& eq = KeyEqual())
+      : hash_(hash), eq_(eq), mask_(0) {}
+
+  void init(size_t capacity) {
+    size_t buckets = 1;
+    while (buckets < capacity) {
+      buckets <<= 1;
+    }
+    buckets_.assign(buckets, detail::kNilIndex);
+    mask_ = buckets - 1;
+  }
+  template <class K>
+  size_t hash(const K& k) const {
+    return static_cast<size_t>(detail::mixHash(hash_(k)));
+  }
+  void prefetch(size_t h) const { detail::prefetch(&buckets_[h & mask_]); }
+  template <class K, class Nodes>
+  index_type find(const K& k, size_t h, const Nodes& nodes) const {
+    for (index_type i = buckets_[h & mask_]; i != detail::kNilIndex;
+         i = nodes.hook(i).chain) {
+      if (eq_(nodes.key(i), k)) {
+        return i;
+      }
+    }
+    return detail::kNilIndex;
+  }
+  template <class Nodes>
+  void insert(index_type i, size_t h, Nodes& nodes) {
+    index_type& head = buckets_[h & mask_];
+    nodes.hook(i).chain = head;
+    head = i;
+  }
+  template <class Nodes>
+  void erase(index_type i, size_t h, Nodes& nodes) {
+    index_type* link = &buckets_[h & mask_];
+    while (*link != i) {
+      link = &nodes.hook(*link).chain;
+    }
+    *link = nodes.hook(i).chain;
+  }
+  void clear() {
+    std::fill(buckets_.begin(), buckets_.end(), detail::kNilIndex);
+  }
+  size_t memoryUsage() const { return buckets_.size() * sizeof(index_type); }
+
+ private:
+  Hash hash_;
+  KeyEqual eq_;
+  size_t mask_;
+  std::vector<index_type> buckets_;
+};
+
+/**
+ *	FlatIndex - open addressing over 16-slot groups of control bytes. Each
+ *full slot keeps a 7 bit hash fingerprint in its control byte, so a probe
+ *compares 16 fingerprints with one SSE2 instruction and only touches a node
+ *(to compare keys) on a fingerprint match. The slots themselves are 32 bit
+ *node indices, no keys are stored in the table.
+ *
+ *	The table is sized for the pool capacity up front and never grows;
+ *deleted slots are reclaimed by an in-place rehash. The 7/8 load limit
+ *always leaves room for capacity / 8 deleted slots on top of a full pool,
+ *so a rehash runs at most once per capacity / 8 erases.
+ */
+template <class Key, class Hash = std::hash<Key>,
+          class KeyEqual = std::equal_to<Key>>
+class FlatIndex {
+ public:
+  typedef uint32_t index_type;
+  struct hook {};
+
+  explicit FlatIndex(const Hash& hash = Hash(), const KeyEqual& eq = KeyEqual())
+      : hash_(hash), eq_(eq), groupMask_(0), size_(0), deleted_(0), maxLoad_(0) {}
+
+  void init(size_t capacity) {
+    const size_t wanted = capacity + capacity / 8 + 1;
+    size_t groups = 1;
+    while (groups * kWidth - groups * kWidth / 8 < wanted) {
+      groups <<= 1;
+    }
+    ctrl_.assign(groups * kWidth, detail::CtrlGroup::kEmpty);
+    slots_.assign(groups * kWidth, detail::kNilIndex);
+    groupMask_ = groups - 1;
+    maxLoad_ = groups * kWidth - groups * kWidth / 8;
+    size_ = deleted_ = 0;
+  }
+  template <class K>
+  size_t hash(const K& k) const {
+    return static_cast<size_t>(detail::mixHash(hash_(k)));
+  }
+  void prefetch(size_t h) const {
+    const size_t base = h1(h) * kWidth;
+    detail::prefetch(&ctrl_[base]);
+    detail::prefetch(&slots_[base]);
+  }
+  template <class K, class Nodes>
+  index_type find(const K& k, size_t h, const Nodes& nodes) const {
+    const int8_t h2 = fingerprint(h);
+    size_t g = h1(h);
+    for (size_t stride = 1; stride <= groupMask_ + 1; ++stride) {
+      const size_t base = g * kWidth;
+      const detail::CtrlGroup group(&ctrl_[base]);
+      for (uint32_t m = group.match(h2); m != 0; m &= m - 1) {
+        const index_type i = slots_[base + detail::lowestBit(m)];
+        if (eq_(nodes.key(i), k)) {
+          return i;
+        }
+      }
+      if (group.matchEmpty() != 0) {
+        break;
+      }
+      g = (g + stride) & groupMask_;
+    }
+    return detail::kNilIndex;
+  }
+  template <class Nodes>
+  void insert(index_type i, size_t h, Nodes& nodes) {
+    if (size_ + deleted_ >= maxLoad_) {
+      rehash(nodes);
+    }
+    insert_nocheck(i, h);
+  }
+  template <class Nodes>
+  void erase(index_type i, size_t h, Nodes&) {
+    const int8_t h2 = fingerprint(h);
+    size_t g = h1(h);
+    for (size_t stride = 1;; ++stride) {
+      const size_t base = g * kWidth;
+      const detail::CtrlGroup group(&ctrl_[base]);
+      for (uint32_t m = group.match(h2); m != 0; m &= m - 1) {
+        const size_t pos = base + detail::lowestBit(m);
+        if (slots_[pos] == i) {
+          // a probe only moves past a group that has no empty slot, so if
+          // this group already has one, nobody can be probing through it
+          if (group.matchEmpty() != 0) {
+            ctrl_[pos] = detail::CtrlGroup::kEmpty;
+          } else {
+            ctrl_[pos] = detail::CtrlGroup::kDeleted;
+            ++deleted_;
+          }
+          slots_[pos] = detail::kNilIndex;
+          --size_;
+          return;
+        }
+      }
+      g = (g + stride) & groupMask_;
+    }
+  }
+  void clear() {
+    std::fill(ctrl_.begin(), ctrl_.end(), detail::CtrlGroup::kEmpty);
+    std::fill(slots_.begin(), slots_.end(), detail::kNilIndex);
+    size_ = deleted_ = 0;
+  }
+  size_t memoryUsage() const {
+    return ctrl_.size() + slots_.size() * sizeof(index_type);
+  }
+
+ private:
+  enum : size_t { kWidth = detail::CtrlGroup::kWidth };
+
+  static int8_t fingerprint(size_t h) { return static_cast<int8_t>(h & 0x7f); }
+  size_t h1(size_t h) const { return (h >> 7) & groupMask_; }
+
+  // the first empty or deleted slot on the probe sequence of h
+  size_t firstFree(size_t h) const {
+    size_t g = h1(h);
+    for (size_t stride = 1;; ++stride) {
+      const size_t base = g * kWidth;
+      const uint32_t m = detail::CtrlGroup(&ctrl_[base]).matchEmptyOrDeleted();
+      if (m != 0) {
+        return base + detail::lowestBit(m);
+      }
+      g = (g + stride) & groupMask_;
+    }
+  }
+  void insert_nocheck(index_type i, size_t h) {
+    const size_t pos = firstFree(h);
+    if (ctrl_[pos] == detail::CtrlGroup::kDeleted) {
+      --deleted_;
+    }
+    ctrl_[pos] = fingerprint(h);
+    slots_[pos] = i;
+    ++size_;
+  }
+  /**
+   * drops the deleted slots in place, without allocating (insert() must
+   * not allocate): every full slot is marked deleted, i.e. not placed yet,
+   * then each one is moved to the first free slot of its probe sequence. a
+   * target holding another unplaced entry swaps with it, which is placed
+   * next. every placed entry only has groups that were full before it on
+   * its probe sequence, so lookups find it
+   */
+  template <class Nodes>
+  void rehash(Nodes& nodes) {
+    for (int8_t& c : ctrl_) {
+      c = c >= 0 ? detail::CtrlGroup::kDeleted : detail::CtrlGroup::kEmpty;
+    }
+    size_t pos = 0;
+    while (pos < ctrl_.size()) {
+      if (ctrl_[pos] != detail::CtrlGroup::kDeleted) {
+        ++pos;
+        continue;
+      }
+      const size_t h = hash(nodes.key(slots_[pos]));
+      const size_t to = firstFree(h);
+      if (to / kWidth == pos / kWidth) {
+        ctrl_[pos] = fingerprint(h);
+        ++pos;
+        continue;
+      }
+      const bool unplaced = ctrl_[to] == detail::CtrlGroup::kDeleted;
+      ctrl_[to] = fingerprint(h);
+      std::swap(slots_[to], slots_[pos]);
+      if (!unplaced) {
+        ctrl_[pos] = detail::CtrlGroup::kEmpty;
+        slots_[pos] = detail::kNilIndex;
+        ++pos;
+      }
+    }
+    deleted_ = 0;
+  }
+
+  Hash hash_;
+  KeyEqual eq_;
+  size_t groupMask_;
+  size_t size_;
+  size_t deleted_;
+  size_t maxLoad_;
+  std::vector<int8_t> ctrl_;
+  std::vector<index_type> slots_;
+};
+
+/**
+ *	A Cache with the same API and the same maxSize/elasticity semantics as
+ *lru11::Cache, but backed by a fixed pool of getMaxAllowedSize() nodes
+ *allocated once in the constructor.
+ *
+ *	Links between nodes are 32 bit pool indices rather than pointers. The
+ *pool cannot grow, so maxSize must be > 0 (an unbounded cache has nothing
+ *to preallocate).
+ *
+ *		Hash / KeyEqual - used by the index
+ *		Index - the key -> node index (default: FlatIndex, see ChainedIndex)
+ */
+template <class Key, class Value, class Lock = NullLock,
+          class Hash = std::hash<Key>, class KeyEqual = std::equal_to<Key>,
+          template <class, class, class> class Index = FlatIndex>
+class PooledCache {
+ public:
+  typedef KeyValuePair<Key, Value> node_type;
+  typedef Index<Key, Hash, KeyEqual> key_index_type;
+  typedef Lock lock_type;
+  using Guard = std::lock_guard<lock_type>;
+  // read-only probes, shared where the lock supports it (see Cache)
+  using ProbeGuard = detail::SharedGuard<lock_type>;
+  typedef uint32_t index_type;
+  static const index_type kNil = detail::kNilIndex;
+  // enables the heterogeneous lookup overloads for non-Key lookup types
+  template <class K>
+  using EnableTransparent = typename std::enable_if<
+      detail::has_is_transparent<Hash>::value &&
+      detail::has_is_transparent<KeyEqual>::value &&
+      !std::is_same<typename std::decay<K>::type, Key>::value>::type;
+
+  explicit PooledCache(size_t maxSize = 64, size_t elasticity = 10,
+                       const Hash& hash = Hash(),
+                       const KeyEqual& eq = KeyEqual())
+      : maxSize_(maxSize),
+        elasticity_(elasticity),
+        capacity_(maxSize + elasticity),
+        pruneBudget_(0),
+        draining_(false),
+        size_(0),
+        head_(kNil),
+        tail_(kNil),
+        free_(kNil),
+        index_(hash, eq) {
+    if (maxSize_ == 0) {
+      throw std::invalid_argument("pooled_cache_requires_max_size");
+    }
+    if (capacity_ >= kNil) {
+      throw std::invalid_argument("pooled_cache_too_large");
+    }
+    pool_.reset(new Entry[capacity_]);
+    for (size_t i = 0; i < capacity_; ++i) {
+      pool_[i].next = (i + 1 < capacity_) ? index_type(i + 1) : kNil;
+    }
+    free_ = 0;
+    index_.init(capacity_);
+  }
+  virtual ~PooledCache() { clear_nolock(); }
+
+  size_t size() const {
+    ProbeGuard g(lock_);
+    return size_;
+  }
+  bool empty() const {
+    ProbeGuard g(lock_);
+    return size_ == 0;
+  }
+  void clear() {
+    Guard g(lock_);
+    clear_nolock();
+  }
+  void insert(const Key& k, Value v) {
+    Guard g(lock_);
+    insert_nolock(k, std::move(v));
+  }
+  void insert(Key&& k, Value&& v) {
+    Guard g(lock_);
+    insert_nolock(std::move(k), std::move(v));
+  }
+  /**
+   * same as insert(), but returns true if k was added and false if an
+   * existing entry was overwritten
+   */
+  bool insert_or_assign(const Key& k, Value v) {
+    Guard g(lock_);
+    return insert_nolock(k, std::move(v));
+  }
+  bool insert_or_assign(Key&& k, Value&& v) {
+    Guard g(lock_);
+    return insert_nolock(std::move(k), std::move(v));
+  }
+  /**
+   * constructs the value for k in place in its pool node from args, if k is
+   * not cached yet. an existing entry is left untouched. returns true if k
+   * was added
+   */
+  template <class... Args>
+  bool emplace(const Key& k, Args&&... args) {
+    Guard g(lock_);
+    return emplace_nolock(k, std::forward<Args>(args)...);
+  }
+  template <class... Args>
+  bool emplace(Key&& k, Args&&... args) {
+    Guard g(lock_);
+    return emplace_nolock(std::move(k), std::forward<Args>(args)...);
+  }
+  /**
+   * batched lookup of keys[0..n) under one lock acquisition, see
+   * Cache::getMany(). all hashes of a chunk are computed and their index
+   * groups prefetched before probing, then the hit nodes are prefetched
+   * before they are read
+   */
+  template <class Keys>
+  size_t getMany(const Keys& keys, std::vector<Value>& values,
+                 std::vector<bool>& found) {
+    enum { kChunk = 16 };
+    size_t hashes[kChunk];
+    index_type hits[kChunk];
+    const size_t n = keys.size();
+    values.resize(n);
+    found.assign(n, false);
+    size_t count = 0;
+    Guard g(lock_);
+    for (size_t base = 0; base < n; base += kChunk) {
+      const size_t m = std::min<size_t>(n - base, kChunk);
+      for (size_t j = 0; j < m; ++j) {
+        hashes[j] = index_.hash(keys[base + j]);
+        index_.prefetch(hashes[j]);
+      }
+      for (size_t j = 0; j < m; ++j) {
+        hits[j] = index_.find(keys[base + j], hashes[j], *this);
+        if (hits[j] != kNil) {
+          detail::prefetch(&pool_[hits[j]]);
+        }
+      }
+      for (size_t j = 0; j < m; ++j) {
+        if (hits[j] != kNil) {
+          moveToFront(hits[j]);
+          values[base + j] = node(hits[j]).value;
+          found[base + j] = true;
+          ++count;
+        }
+      }
+    }
+    return count;
+  }
+  /**
+   * inserts every (key, value) pair of [first, last) under one lock
+   * acquisition (pairs are moved from with std::make_move_iterator)
+   */
+  template <class It>
+  void insertMany(It first, It last) {
+    Guard g(lock_);
+    for (; first != last; ++first) {
+      insertOne_nolock(*first);
+    }
+  }
+  template <class Range>
+  void insertMany(const Range& items) {
+    insertMany(std::begin(items), std::end(items));
+  }
+  /**
+    for backward compatibity. redirects to tryGetCopy()
+   */
+  bool tryGet(const Key& kIn, Value& vOut) { return tryGetCopy(kIn, vOut); }
+
+  bool tryGetCopy(const Key& kIn, Value& vOut) {
+    Guard g(lock_);
+    return tryGetRef_nolock(kIn, vOut);
+  }
+
+  bool tryGetRef(const Key& kIn, Value& vOut) {
+    Guard g(lock_);
+    return tryGetRef_nolock(kIn, vOut);
+  }
+  /**
+   *	The const reference returned here is only
+   *    guaranteed to be valid till the next insert/delete
+   *  in multi-threaded apps use getCopy() to be threadsafe
+   */
+  const Value& getRef(const Key& k) {
+    Guard g(lock_);
+    return get_nolock(k);
+  }
+  Value get(const Key& k) { return getCopy(k); }
+  Value getCopy(const Key& k) {
+    Guard g(lock_);
+    return get_nolock(k);
+  }
+  bool remove(const Key& k) {
+    Guard g(lock_);
+    return remove_nolock(k);
+  }
+  bool contains(const Key& k) const {
+    ProbeGuard g(lock_);
+    return find_nolock(k) != kNil;
+  }
+  // see Cache::peek(), reads without moving the node to the front
+  bool tryPeek(const Key& kIn, Value& vOut) const {
+    ProbeGuard g(lock_);
+    return tryPeek_nolock(kIn, vOut);
+  }
+  Value peek(const Key& k) const {
+    ProbeGuard g(lock_);
+    return peek_nolock(k);
+  }
+
+  /**
+   *	heterogeneous lookups, enabled when both Hash and KeyEqual are
+   *transparent (declare is_transparent and accept the lookup type)
+   */
+  template <class K, class = EnableTransparent<K>>
+  bool tryGet(const K& kIn, Value& vOut) {
+    return tryGetCopy(kIn, vOut);
+  }
+  template <class K, class = EnableTransparent<K>>
+  bool tryGetCopy(const K& kIn, Value& vOut) {
+    Guard g(lock_);
+    return tryGetRef_nolock(kIn, vOut);
+  }
+  template <class K, class = EnableTransparent<K>>
+  bool tryGetRef(const K& kIn, Value& vOut) {
+    Guard g(lock_);
+    return tryGetRef_nolock(kIn, vOut);
+  }
+  template <class K, class = EnableTransparent<K>>
+  const Value& getRef(const K& k) {
+    Guard g(lock_);
+    return get_nolock(k);
+  }
+  template <class K, class = EnableTransparent<K>>
+  Value get(const K& k) {
+    return getCopy(k);
+  }
+  template <class K, class = EnableTransparent<K>>
+  Value getCopy(const K& k) {
+    Guard g(lock_);
+    return get_nolock(k);
+  }
+  template <class K, class = EnableTransparent<K>>
+  bool remove(const K& k) {
+    Guard g(lock_);
+    return remove_nolock(k);
+  }
+  template <class K, class = EnableTransparent<K>>
+  bool contains(const K& k) const {
+    ProbeGuard g(lock_);
+    return find_nolock(k) != kNil;
+  }
+  template <class K, class = EnableTransparent<K>>
+  bool tryPeek(const K& kIn, Value& vOut) const {
+    ProbeGuard g(lock_);
+    return tryPeek_nolock(kIn, vOut);
+  }
+  template <class K, class = EnableTransparent<K>>
+  Value peek(const K& k) const {
+    ProbeGuard g(lock_);
+    return peek_nolock(k);
+  }
+
+  size_t getMaxSize() const { return maxSize_; }
+  size_t getElasticity() const { return elasticity_; }
+  size_t getMaxAllowedSize() const { return maxSize_ + elasticity_; }
+  // see Cache::setPruneBudget() and Cache::maintain()
+  void setPruneBudget(size_t budget) {
+    Guard g(lock_);
+    pruneBudget_ = budget;
+  }
+  size_t getPruneBudget() const {
+    ProbeGuard g(lock_);
+    return pruneBudget_;
+  }
+  size_t maintain(size_t budget) {
+    Guard g(lock_);
+    return trim_nolock(budget);
+  }
+  /**
+   * see Cache::checkInvariants(): the list is linked both ways, every node
+   * on it is found by the index, and the list and free list together hold
+   * the whole pool
+   */
+  bool checkInvariants() const {
+    Guard g(lock_);
+    size_t n = 0;
+    index_type prev = kNil;
+    for (index_type i = head_; i != kNil; prev = i, i = pool_[i].next) {
+      if (pool_[i].prev != prev || find_nolock(key(i)) != i || ++n > size_) {
+        return false;
+      }
+    }
+    if (prev != tail_ || n != size_) {
+      return false;
+    }
+    size_t free = 0;
+    for (index_type i = free_; i != kNil; i = pool_[i].next) {
+      if (++free > capacity_) {
+        return false;
+      }
+    }
+    return n + free == capacity_ &&
+           (draining_ || size_ <= maxSize_ + elasticity_);
+  }
+  /**
+   * walks the nodes in MRU -> LRU order, same as Cache::cwalk()
+   */
+  template <typename F>
+  void cwalk(F& f) const {
+    ProbeGuard g(lock_);
+    for (index_type i = head_; i != kNil; i = pool_[i].next) {
+      f(node(i));
+    }
+  }
+
+ protected:
+  template <class K>
+  index_type find_nolock(const K& k) const {
+    return index_.find(k, index_.hash(k), *this);
+  }
+  template <class K>
+  bool tryPeek_nolock(const K& kIn, Value& vOut) const {
+    const index_type i = find_nolock(kIn);
+    if (i == kNil) {
+      return false;
+    }
+    vOut = node(i).value;
+    return true;
+  }
+  template <class K>
+  Value peek_nolock(const K& k) const {
+    const index_type i = find_nolock(k);
+    if (i == kNil) {
+      throw KeyNotFound();
+    }
+    return node(i).value;
+  }
+  template <class P>
+  void insertOne_nolock(P&& kv) {
+    insert_nolock(std::forward<P>(kv).first, std::forward<P>(kv).second);
+  }
+  template <class K, class V>
+  bool insert_nolock(K&& k, V&& v) {
+    const size_t h = index_.hash(k);
+    const index_type i = index_.find(k, h, *this);
+    if (i != kNil) {
+      node(i).value = std::forward<V>(v);
+      moveToFront(i);
+      return false;
+    }
+    link_nolock(h, std::forward<K>(k), std::forward<V>(v));
+    return true;
+  }
+  template <class K, class... Args>
+  bool emplace_nolock(K&& k, Args&&... args) {
+    const size_t h = index_.hash(k);
+    if (index_.find(k, h, *this) != kNil) {
+      return false;
+    }
+    link_nolock(h, std::forward<K>(k), std::forward<Args>(args)...);
+    return true;
+  }
+  // constructs a node for a key that is not cached yet in a free slot
+  template <class... Args>
+  void link_nolock(size_t h, Args&&... args) {
+    if (free_ == kNil) {
+      // only reachable with elasticity == 0, where Cache would also evict
+      // the LRU entry right after inserting
+      evict(tail_);
+    }
+    const index_type i = free_;
+    new (&pool_[i].storage)
+        node_type(std::piecewise_construct, std::forward<Args>(args)...);
+    free_ = pool_[i].next;
+    linkFront(i);
+    index_.insert(i, h, *this);
+    ++size_;
+    prune();
+  }
+  template <class K>
+  const Value& get_nolock(const K& k) {
+    const index_type i = find_nolock(k);
+    if (i == kNil) {
+      throw KeyNotFound();
+    }
+    moveToFront(i);
+    return node(i).value;
+  }
+  template <class K>
+  bool tryGetRef_nolock(const K& kIn, Value& vOut) {
+    const index_type i = find_nolock(kIn);
+    if (i == kNil) {
+      return false;
+    }
+    moveToFront(i);
+    vOut = node(i).value;
+    return true;
+  }
+  template <class K>
+  bool remove_nolock(const K& k) {
+    const index_type i = find_nolock(k);
+    if (i == kNil) {
+      return false;
+    }
+    evict(i);
+    return true;
+  }
+  size_t prune() {
+    if (size_ >= maxSize_ + elasticity_) {
+      draining_ = true;
+    }
+    if (!draining_) {
+      return 0;
+    }
+    return trim_nolock(pruneBudget_ != 0 ? pruneBudget_ : size_);
+  }
+  // evicts up to budget entries over maxSize, the drain ends at maxSize
+  size_t trim_nolock(size_t budget) {
+    size_t count = 0;
+    while (count < budget && size_ > maxSize_) {
+      evict(tail_);
+      ++count;
+    }
+    if (size_ <= maxSize_) {
+      draining_ = false;
+    }
+    return count;
+  }
+
+ private:
+  friend key_index_type;
+  typedef typename key_index_type::hook index_hook;
+
+  // one pool slot: the index hook, LRU links and the (lazily constructed)
+  // key/value pair. free slots are chained through next.
+  struct Entry : index_hook {
+    index_type prev;
+    index_type next;
+    typename std::aligned_storage<sizeof(node_type),
+                                  alignof(node_type)>::type storage;
+  };
+
+  // node access for the index
+  const Key& key(index_type i) const { return node(i).key; }
+  index_hook& hook(index_type i) { return pool_[i]; }
+  const index_hook& hook(index_type i) const { return pool_[i]; }
+
+  node_type& node(index_type i) {
+    return *reinterpret_cast<node_type*>(&pool_[i].storage);
+  }
+  const node_type& node(index_type i) const {
+    return *reinterpret_cast<const node_type*>(&pool_[i].storage);
+  }
+  void linkFront(index_type i) {
+    pool_[i].prev = kNil;
+    pool_[i].next = head_;
+    if (head_ != kNil) {
+      pool_[head_].prev = i;
+    } else {
+      tail_ = i;
+    }
+    head_ = i;
+  }
+  void unlink(index_type i) {
+    const Entry& e = pool_[i];
+    if (e.prev != kNil) {
+      pool_[e.prev].next = e.next;
+    } else {
+      head_ = e.next;
+    }
+    if (e.next != kNil) {
+      pool_[e.next].prev = e.prev;
+    } else {
+      tail_ = e.prev;
+    }
+  }
+  void moveToFront(index_type i) {
+    if (i != head_) {
+      unlink(i);
+      linkFront(i);
+    }
+  }
+  void evict(index_type i) {
+    index_.erase(i, index_.hash(node(i).key), *this);
+    unlink(i);
+    node(i).~node_type();
+    pool_[i].next = free_;
+    free_ = i;
+    --size_;
+  }
+  void clear_nolock() {
+    for (index_type i = head_; i != kNil;) {
+      const index_type next = pool_[i].next;
+      node(i).~node_type();
+      pool_[i].next = free_;
+      free_ = i;
+      i = next;
+    }
+    head_ = tail_ = kNil;
+    size_ = 0;
+    index_.clear();
+  }
+
+  // Disallow copying.
+  PooledCache(const PooledCache&) = delete;
+  PooledCache& operator=(const PooledCache&) = delete;
+
+  mutable Lock lock_;
+  size_t maxSize_;
+  size_t elasticity_;
+  size_t capacity_;
+  size_t pruneBudget_;
+  // between reaching the hard limit and getting back to maxSize
+  bool draining_;
+  size_t size_;
+  index_type head_;
+  index_type tail_;
+  index_type free_;
+  std::unique_ptr<Entry[]> pool_;
+  key_index_type index_;
+};
+
+template <class Key, class Value, class Lock, class Hash, class KeyEqual,
+          template <class, class, class> class Index>
+const typename PooledCache<Key, Value, Lock, Hash, KeyEqual, Index>::index_type
+    PooledCache<Key, Value, Lock, Hash, KeyEqual, Index>::kNil;
+
+}  // namespace lru11
@@ -31,8 +31,20 @@
 #include <vector>
 #include <sstream>
 #include <memory>
+#include <cassert>
+#include <cstring>
+#include <map>
+#include <random>
 
 #include "LRUCache11.hpp"
+#include "LRUCache11Pooled.hpp"
+#include "LRUCache11Compact.hpp"
+#include "LRUCache11Tiered.hpp"
+#include "LRUCache11Numa.hpp"
+#include "LRUCache11BTree.hpp"
+#if __cplusplus >= 202002L && defined(__cpp_impl_coroutine)
+#include "LRUCache11Async.hpp"
+#endif
 
 using namespace lru11;
 typedef Cache<std::string, int32_t> KVCache;
@@ -109,12 +121,1322 @@ void testWithLock() {
 		w->join();
 	}
 	std::cout << "... workers finished!" << std::endl;
+	assert(lc.size() <= lc.getMaxAllowedSize() && lc.checkInvariants());
 	cachePrint2(lc);
 }
 
+// Test the sharded cache: keys spread over shards, size/cwalk aggregate
+void testSharded() {
+	using SCache = ShardedCache<int, int, std::mutex>;
+	SCache sc(64, 8, 4);
+	assert(sc.shardCount() == 4);
+	assert(sc.getMaxSize() == 64);
+	for (int i = 0; i < 32; i++) {
+		sc.insert(i, i * 10);
+	}
+	assert(sc.size() == 32);
+	int v = 0;
+	assert(sc.tryGet(7, v) && v == 70);
+	assert(sc.get(31) == 310);
+	assert(sc.remove(7));
+	assert(!sc.contains(7));
+	size_t walked = 0;
+	auto counter = [&] (const SCache::node_type&) { ++walked; };
+	sc.cwalk(counter);
+	assert(walked == sc.size());
+
+	// the budget is enforced per shard, so the total stays bounded
+	for (int i = 0; i < 10000; i++) {
+		sc.insert(i, i);
+	}
+	assert(sc.size() <= sc.getMaxAllowedSize());
+	std::cout << "... sharded cache ok (size: " << sc.size() << ")" << std::endl;
+}
+
+// Test the pooled (allocation-free) storage mode against the same LRU rules
+void testPooled() {
+	using PCache = PooledCache<std::string, int32_t>;
+	PCache pc(5, 2);
+	const char* keys[] = {"hello", "world", "foo", "bar", "blanga", "toodloo"};
+	for (int i = 0; i < 6; i++) {
+		pc.insert(keys[i], i + 1);
+	}
+	assert(pc.size() == 6);
+	pc.get("hello");
+	pc.insert("wagamama", 7);
+	// hit the hard limit (7), pruned back to 5, "hello" survived the prune
+	assert(pc.size() == 5);
+	assert(pc.contains("hello"));
+	assert(!pc.contains("world"));
+	assert(!pc.contains("foo"));
+	int32_t v = 0;
+	assert(pc.tryGet("bar", v) && v == 4);
+	pc.insert("bar", 40);
+	assert(pc.getCopy("bar") == 40);
+	assert(pc.remove("bar") && !pc.contains("bar"));
+	std::vector<std::string> order;
+	auto collect = [&] (const PCache::node_type& n) { order.push_back(n.key); };
+	pc.cwalk(collect);
+	assert(order.size() == pc.size() && order.front() == "wagamama");
+
+	// same rules with the chained index and a lot of churn through the table
+	PooledCache<int, int, NullLock, std::hash<int>, std::equal_to<int>, ChainedIndex> chained(100, 10);
+	PooledCache<int, int> flat(100, 10);
+	for (int i = 0; i < 20000; i++) {
+		chained.insert(i % 1500, i);
+		flat.insert(i % 1500, i);
+		assert(chained.contains(i % 1500) && flat.contains(i % 1500));
+		if (i % 3 == 0) {
+			chained.remove(i % 1400);
+			flat.remove(i % 1400);
+		}
+	}
+	assert(chained.size() == flat.size());
+	for (int i = 0; i < 1500; i++) {
+		assert(chained.contains(i) == flat.contains(i));
+	}
+	// a pool just under a power-of-two table boundary (917503 + 1 was the
+	// table's whole load limit) must still leave room for tombstones, or
+	// every insert of a steady-state churn rehashes the whole table
+	{
+		const size_t cap = 917503;
+		PooledCache<int, int> edge(cap, 0);
+		CompactCache<int, int> compactEdge(cap, 0);
+		for (int i = 0; i < static_cast<int>(cap); i++) {
+			edge.insert(i, i);
+			compactEdge.insert(i, i);
+		}
+		const auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < 200000; i++) {
+			const int k = static_cast<int>(cap) + i;
+			edge.insert(k, i);
+			compactEdge.insert(k, i);
+		}
+		const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		// ~0.1s normally, hours with a rehash per insert
+		assert(seconds < 30 && edge.size() == cap && edge.contains(static_cast<int>(cap) + 199999));
+		assert(edge.checkInvariants() && compactEdge.checkInvariants());
+	}
+	// random removes leave tombstones, and the in-place rehash that drops
+	// them must keep every entry reachable
+	std::minstd_rand rng(7);
+	PooledCache<int, int, NullLock, std::hash<int>, std::equal_to<int>, ChainedIndex> model(200, 0);
+	PooledCache<int, int> churn(200, 0);
+	for (int i = 0; i < 50000; i++) {
+		const int k = static_cast<int>(rng() % 600);
+		if (rng() % 2 == 0) {
+			model.insert(k, i);
+			churn.insert(k, i);
+		} else {
+			assert(model.remove(k) == churn.remove(k));
+		}
+		if (i % 500 == 0) {
+			assert(churn.checkInvariants() && churn.size() == model.size());
+			for (int j = 0; j < 600; j++) {
+				assert(churn.contains(j) == model.contains(j));
+			}
+		}
+	}
+
+	PooledCache<int, int> zero(3, 0);
+	for (int i = 0; i < 100; i++) {
+		zero.insert(i, i);
+		assert(zero.size() <= 3);
+	}
+	assert(zero.contains(99) && !zero.contains(96));
+	pc.clear();
+	assert(pc.empty());
+	std::cout << "... pooled cache ok" << std::endl;
+}
+
+// Test deferred promotion: hits are buffered and replayed on the next write
+void testBufferedLRU() {
+	using BCache = Cache<int, int, NullLock, std::unordered_map<int, int>, BufferedLRUPolicy>;
+	BCache bc(3, 0);
+	bc.insert(1, 1);
+	bc.insert(2, 2);
+	bc.insert(3, 3);
+	assert(bc.get(1) == 1);
+	// the hit on 1 is replayed before 4 is inserted, so 2 is the LRU entry
+	bc.insert(4, 4);
+	assert(bc.contains(1) && !bc.contains(2));
+
+	using MTCache = Cache<int, int, std::mutex, std::unordered_map<int, int>, BufferedLRUPolicy>;
+	MTCache mc(100, 10);
+	for (int i = 0; i < 100; i++) {
+		mc.insert(i, i);
+	}
+	auto reader = [&] () {
+		int v = 0;
+		for (int i = 0; i < 10000; i++) {
+			if (mc.tryGet(i % 50, v)) {
+				assert(v == i % 50);
+			}
+			if (i % 100 == 0) {
+				mc.insert(100 + i, i);
+			}
+		}
+	};
+	std::vector<std::unique_ptr<std::thread>> readers;
+	for (int i = 0; i < 8; i++) {
+		readers.push_back(std::unique_ptr<std::thread>(new std::thread(reader)));
+	}
+	for (const auto& r : readers) {
+		r->join();
+	}
+	// the hot half survived all the inserts
+	for (int i = 0; i < 50; i++) {
+		assert(mc.contains(i));
+	}
+	std::cout << "... buffered lru ok" << std::endl;
+}
+
+// Test CLOCK: a referenced entry gets a second chance instead of being evicted
+void testClock() {
+	using CCache = Cache<int, int, NullLock, std::unordered_map<int, int>, ClockPolicy>;
+	CCache cc(3, 1);
+	cc.insert(1, 1);
+	cc.insert(2, 2);
+	cc.insert(3, 3);
+	assert(cc.get(1) == 1);
+	assert(cc.get(2) == 2);
+	// hits don't reorder, 1 is still the oldest entry
+	std::vector<int> order;
+	auto collect = [&] (const CCache::node_type& n) { order.push_back(n.key); };
+	cc.cwalk(collect);
+	assert(order.back() == 1);
+	// hard limit (4) reached: 1 and 2 get a second chance, 3 goes
+	cc.insert(4, 4);
+	assert(cc.size() == 3);
+	assert(cc.contains(1) && cc.contains(2) && !cc.contains(3) && cc.contains(4));
+	std::cout << "... clock policy ok" << std::endl;
+}
+
+// Test W-TinyLFU: a scan of one-hit wonders must not flush the hot set
+void testTinyLFU() {
+	using TCache = Cache<int, int, NullLock, std::unordered_map<int, int>, TinyLFUPolicy>;
+	TCache tc(100, 0);
+	Cache<int, int> lru(100, 0);
+	size_t tinyHits = 0, lruHits = 0;
+	auto access = [&] (int k) {
+		int v = 0;
+		if (tc.tryGet(k, v)) {
+			++tinyHits;
+		} else {
+			tc.insert(k, k);
+		}
+		if (lru.tryGet(k, v)) {
+			++lruHits;
+		} else {
+			lru.insert(k, k);
+		}
+	};
+	for (int i = 0; i < 500; i++) {
+		access(i % 50);
+	}
+	// a hot key now comes back every 150 accesses, beyond the LRU's reach
+	tinyHits = lruHits = 0;
+	for (int i = 0; i < 6000; i++) {
+		access(1000 + i);
+		if (i % 2 == 0) {
+			access((i / 2) % 50);
+		}
+	}
+	assert(lruHits < 100);
+	assert(tinyHits >= 2500);
+	assert(tc.size() == 100);
+	size_t walked = 0;
+	auto counter = [&] (const TCache::node_type&) { ++walked; };
+	tc.cwalk(counter);
+	assert(walked == tc.size());
+	for (int i = 0; i < 7000; i++) {
+		tc.remove(i);
+	}
+	assert(tc.empty());
+	std::cout << "... tinylfu policy ok (hot hits: " << tinyHits << "/3000, lru: " << lruHits << ")" << std::endl;
+}
+
+// Test weight based capacity: entries weigh their string length
+struct LengthWeigher {
+	size_t operator()(const std::string&, const std::string& v) const { return v.size(); }
+};
+void testWeighted() {
+	using WCache = Cache<std::string, std::string, NullLock,
+			std::unordered_map<std::string, std::string>, LRUPolicy, LengthWeigher>;
+	WCache wc(0, 0, 100);
+	wc.insert("a", std::string(40, 'a'));
+	wc.insert("b", std::string(40, 'b'));
+	assert(wc.currentWeight() == 80);
+	wc.get("a");
+	// 80 + 30 is over budget, the LRU entry "b" goes
+	wc.insert("c", std::string(30, 'c'));
+	assert(wc.currentWeight() == 70);
+	assert(wc.contains("a") && !wc.contains("b") && wc.contains("c"));
+	// growing an entry in place also prunes
+	wc.insert("c", std::string(70, 'c'));
+	assert(!wc.contains("a") && wc.currentWeight() == 70);
+	// heavier than the whole budget: not cached
+	wc.insert("d", std::string(101, 'd'));
+	assert(!wc.contains("d") && wc.size() == 1);
+	assert(wc.remove("c") && wc.currentWeight() == 0);
+	std::cout << "... weighted cache ok" << std::endl;
+}
+
+// Test expiry with a manual clock so the test doesn't sleep
+struct ManualClock {
+	typedef std::chrono::milliseconds duration;
+	typedef duration::rep rep;
+	typedef duration::period period;
+	typedef std::chrono::time_point<ManualClock> time_point;
+	static const bool is_steady = true;
+	static time_point now() { return time_point(duration(nowMs)); }
+	static int64_t nowMs;
+};
+int64_t ManualClock::nowMs = 0;
+
+void testExpiry() {
+	using ECache = Cache<std::string, int, NullLock, std::unordered_map<std::string, int>,
+			LRUPolicy, NoWeigher, TimedExpiry<ManualClock>>;
+	using std::chrono::milliseconds;
+	ECache ec(2000, 10);
+	ec.setDefaultTtl(milliseconds(1000));
+	ec.insert("default", 1);
+	ec.insert("short", 2, milliseconds(10));
+	ec.insert("forever", 3, milliseconds(0));
+	ec.insert("long", 4, milliseconds(10000000));
+	int v = 0;
+	assert(ec.tryGet("short", v) && v == 2);
+	ManualClock::nowMs = 10;
+	// lazily expired, but still taking space until the wheel gets there
+	assert(!ec.tryGet("short", v) && !ec.contains("short"));
+	assert(ec.size() == 4);
+	ec.insert("trigger", 5, milliseconds(0));
+	assert(ec.size() == 4);
+	// an update restarts the ttl
+	ManualClock::nowMs = 900;
+	ec.insert("default", 10);
+	ManualClock::nowMs = 1500;
+	ec.insert("trigger", 6, milliseconds(0));
+	assert(ec.contains("default") && ec.get("default") == 10);
+	ManualClock::nowMs = 1950;
+	ec.insert("trigger", 6, milliseconds(0));
+	assert(!ec.contains("default") && ec.size() == 3);
+	// far beyond the bottom wheel levels
+	ManualClock::nowMs = 9999999;
+	ec.insert("trigger", 7, milliseconds(0));
+	assert(ec.contains("long") && ec.size() == 3);
+	ManualClock::nowMs = 10000001;
+	ec.insert("trigger", 8, milliseconds(0));
+	assert(!ec.contains("long") && ec.size() == 2);
+	assert(ec.contains("forever") && ec.contains("trigger"));
+
+	// lots of entries with spread out ttls all get reclaimed
+	for (int i = 0; i < 1000; i++) {
+		ec.insert(std::to_string(i), i, milliseconds(1 + (i * 37) % 5000));
+	}
+	ManualClock::nowMs += 5001;
+	ec.insert("trigger", 9, milliseconds(0));
+	assert(ec.size() == 2);
+	std::cout << "... expiry ok" << std::endl;
+}
+
+// Test refresh ahead: a stale hit returns the old value and queues a reload
+void testRefresh() {
+	using RCache = Cache<std::string, int, std::mutex,
+			std::unordered_map<std::string, int>, LRUPolicy, NoWeigher, TimedExpiry<ManualClock>>;
+	RCache rc(10, 2);
+	std::vector<std::function<void()>> queued;
+	int version = 0;
+	rc.setDefaultTtl(std::chrono::milliseconds(100));
+	rc.setRefresh(std::chrono::milliseconds(50),
+			[&version](const std::string&) { return ++version; },
+			[&queued](std::function<void()> task) { queued.push_back(std::move(task)); });
+	rc.insert("k", 0);
+	ManualClock::nowMs += 40;
+	assert(rc.get("k") == 0 && queued.empty());
+	ManualClock::nowMs += 20;
+	// stale: still a hit, one reload queued however often it is hit
+	assert(rc.get("k") == 0 && rc.get("k") == 0 && queued.size() == 1);
+	queued[0]();
+	queued.clear();
+	assert(rc.get("k") == 1);
+	// the reload restarted the ttl, 60 + 60 would have expired the original
+	ManualClock::nowMs += 60;
+	assert(rc.get("k") == 1 && queued.size() == 1);
+	// an entry removed before its reload runs is not brought back
+	rc.remove("k");
+	queued[0]();
+	assert(!rc.contains("k"));
+	std::cout << "... refresh ahead ok" << std::endl;
+}
+
+// Test the removal listener: every cause, delivered outside the lock
+void testRemovalListener() {
+	using LCache = Cache<std::string, int, std::mutex,
+			std::unordered_map<std::string, int>, LRUPolicy, NoWeigher, TimedExpiry<ManualClock>>;
+	LCache lc(2, 0);
+	std::vector<std::string> seen;
+	lc.setRemovalListener([&](const std::string& k, int& v, RemovalCause cause) {
+		// the lock is free here, calling back into the cache works
+		assert(lc.size() <= 2);
+		const char* names[] = {"size", "expired", "explicit", "replaced"};
+		seen.push_back(k + "=" + std::to_string(v) + ":" + names[static_cast<int>(cause)]);
+	});
+	lc.insert("a", 1);
+	lc.insert("b", 2);
+	lc.insert("a", 10);
+	lc.insert("c", 3);
+	lc.remove("c");
+	lc.insert("d", 4, std::chrono::milliseconds(5));
+	ManualClock::nowMs += 10;
+	lc.insert("e", 5);
+	lc.clear();
+	const std::vector<std::string> expected = {"a=1:replaced", "b=2:size",
+			"c=3:explicit", "d=4:expired", "e=5:explicit", "a=10:explicit"};
+	assert(seen == expected);
+	std::cout << "... removal listener ok" << std::endl;
+}
+
+// Test statistics
+void testStats() {
+	Cache<int, int, std::mutex, std::unordered_map<int, int>, LRUPolicy,
+			NoWeigher, NoExpiry, AtomicStats<true>> c(4, 0);
+	for (int i = 0; i < 6; i++) {
+		c.insert(i, i);
+	}
+	c.insert(5, 50);
+	int v = 0;
+	assert(c.tryGet(5, v) && !c.tryGet(0, v));
+	std::vector<int> keys = {1, 2, 3};
+	std::vector<int> values;
+	std::vector<bool> found;
+	c.getMany(keys, values, found);
+	c.remove(5);
+	StatsSnapshot st = c.getStats();
+	assert(st.inserts == 6 && st.updates == 1);
+	assert(st.hits == 3 && st.misses == 2);
+	assert(st.evictions == 2 && st.pruneRuns == 2 && st.removals == 1);
+	assert(st.hitRatio() == 0.6);
+	size_t exported = 0;
+	st.visit([&exported](const char*, uint64_t) { ++exported; });
+	assert(exported == 10);
+
+	ShardedCache<int, int, std::mutex, std::unordered_map<int, int>, std::hash<int>,
+			LRUPolicy, NoWeigher, NoExpiry, AtomicStats<>> sc(64, 0, 4);
+	for (int i = 0; i < 100; i++) {
+		sc.insert(i, i);
+	}
+	assert(sc.getStats().inserts == 100 && sc.getStats().evictions == 36);
+	Cache<int, int> plain;
+	plain.insert(1, 1);
+	assert(plain.getStats().inserts == 0);
+	std::cout << "... stats ok" << std::endl;
+}
+
+// Test heterogeneous lookups: const char* keys are looked up without
+// building a std::string
+struct StringHash {
+	typedef void is_transparent;
+	size_t hash(const char* p, size_t n) const {
+		size_t h = 14695981039346656037ULL;
+		for (size_t i = 0; i < n; i++) {
+			h = (h ^ static_cast<unsigned char>(p[i])) * 1099511628211ULL;
+		}
+		return h;
+	}
+	size_t operator()(const std::string& s) const { return hash(s.data(), s.size()); }
+	size_t operator()(const char* s) const { return hash(s, strlen(s)); }
+};
+struct StringEqual {
+	typedef void is_transparent;
+	bool operator()(const std::string& a, const std::string& b) const { return a == b; }
+	bool operator()(const std::string& a, const char* b) const { return a == b; }
+	bool operator()(const char* a, const std::string& b) const { return b == a; }
+};
+void testTransparent() {
+	PooledCache<std::string, int, NullLock, StringHash, StringEqual> pc(10, 2);
+	pc.insert("hello", 1);
+	pc.insert("world", 2);
+	const char* key = "hello";
+	int v = 0;
+	assert(pc.tryGet(key, v) && v == 1);
+	assert(pc.contains(key) && pc.getCopy(key) == 1);
+	assert(pc.remove(key) && !pc.contains(key));
+	assert(pc.contains(std::string("world")));
+	std::cout << "... transparent lookup ok" << std::endl;
+}
+
+// Test move-aware inserts: rvalues are moved, never copied, and move-only
+// values work
+struct CountedValue {
+	static int copies;
+	int v;
+	CountedValue(int x = 0) : v(x) {}
+	CountedValue(int a, int b) : v(a * b) {}
+	CountedValue(const CountedValue& o) : v(o.v) { ++copies; }
+	CountedValue(CountedValue&& o) : v(o.v) {}
+	CountedValue& operator=(const CountedValue& o) { v = o.v; ++copies; return *this; }
+	CountedValue& operator=(CountedValue&& o) { v = o.v; return *this; }
+};
+int CountedValue::copies = 0;
+void testMoveInsert() {
+	Cache<std::string, CountedValue> cc(10, 2);
+	cc.insert(std::string("a"), CountedValue(1));
+	cc.insert(std::string("a"), CountedValue(2));
+	assert(cc.emplace("b", 6, 7));
+	assert(!cc.emplace("b", 1));
+	assert(cc.insert_or_assign("c", CountedValue(3)));
+	assert(!cc.insert_or_assign("c", CountedValue(4)));
+	assert(CountedValue::copies == 0);
+	assert(cc.getRef("a").v == 2 && cc.getRef("b").v == 42 && cc.getRef("c").v == 4);
+
+	Cache<int, std::unique_ptr<int>> uc(2, 0);
+	uc.insert(1, std::unique_ptr<int>(new int(1)));
+	uc.emplace(2, new int(2));
+	uc.insert(1, std::unique_ptr<int>(new int(10)));
+	uc.insert(3, std::unique_ptr<int>(new int(3)));
+	assert(!uc.contains(2) && *uc.getRef(1) == 10 && *uc.getRef(3) == 3);
+
+	PooledCache<int, std::unique_ptr<int>> up(2, 0);
+	assert(up.emplace(1, new int(1)));
+	assert(!up.insert_or_assign(1, std::unique_ptr<int>(new int(5))));
+	assert(*up.getRef(1) == 5);
+	std::cout << "... move insert ok" << std::endl;
+}
+
+// Test value handles: a handle outlives the eviction of its entry
+void testValueHandle() {
+	SharedValueCache<int, std::string, std::mutex> hc(2, 0);
+	hc.insert(1, std::make_shared<const std::string>(1000, 'x'));
+	ValueHandle<std::string> h = hc.getCopy(1);
+	hc.insert(2, std::make_shared<const std::string>("two"));
+	hc.insert(3, std::make_shared<const std::string>("three"));
+	assert(!hc.contains(1));
+	assert(h.use_count() == 1 && h->size() == 1000);
+	ValueHandle<std::string> h3;
+	assert(hc.tryGetCopy(3, h3) && *h3 == "three" && h3.use_count() == 2);
+	std::cout << "... value handles ok" << std::endl;
+}
+
+// Test batched lookups and inserts
+template <class C>
+void checkBatch(C& c, const char* name) {
+	std::vector<std::pair<int, int>> items;
+	for (int i = 0; i < 100; i++) {
+		items.push_back(std::make_pair(i, i * 10));
+	}
+	c.insertMany(items);
+	std::vector<int> keys;
+	for (int i = 50; i < 150; i++) {
+		keys.push_back(i);
+	}
+	std::vector<int> values;
+	std::vector<bool> found;
+	assert(c.getMany(keys, values, found) == 50);
+	for (size_t i = 0; i < keys.size(); i++) {
+		assert(found[i] == (keys[i] < 100));
+		assert(!found[i] || values[i] == keys[i] * 10);
+	}
+	std::cout << "... " << name << " batch ok" << std::endl;
+}
+void testBatch() {
+	Cache<int, int, std::mutex> c(200, 10);
+	checkBatch(c, "cache");
+	ShardedCache<int, int, std::mutex> sc(256, 16, 4);
+	checkBatch(sc, "sharded");
+	PooledCache<int, int, std::mutex> pc(200, 10);
+	checkBatch(pc, "pooled");
+	PooledCache<int, int, std::mutex, std::hash<int>, std::equal_to<int>, ChainedIndex> cc(200, 10);
+	checkBatch(cc, "chained");
+
+	// moved from pairs
+	std::vector<std::pair<std::string, std::unique_ptr<int>>> ups;
+	ups.push_back(std::make_pair(std::string("a"), std::unique_ptr<int>(new int(1))));
+	Cache<std::string, std::unique_ptr<int>> uc(10, 2);
+	uc.insertMany(std::make_move_iterator(ups.begin()), std::make_move_iterator(ups.end()));
+	assert(*uc.getRef("a") == 1 && !ups[0].second);
+}
+
+// Test getOrLoad: concurrent misses on one key run the loader once
+void testGetOrLoad() {
+	ShardedCache<std::string, int, std::mutex> sc(64, 8, 4);
+	std::atomic<int> loads(0);
+	auto slowLoader = [&loads](const std::string& k) {
+		++loads;
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		return static_cast<int>(k.size());
+	};
+	std::vector<std::thread> threads;
+	std::atomic<int> sum(0);
+	for (int i = 0; i < 16; i++) {
+		threads.emplace_back([&]() { sum += sc.getOrLoad("hot key", slowLoader); });
+	}
+	for (auto& t : threads) {
+		t.join();
+	}
+	assert(loads == 1 && sum == 16 * 7);
+	assert(sc.get("hot key") == 7);
+
+	// a failed load is not cached and the next call loads again
+	Cache<int, int, std::mutex> c(10, 2);
+	bool threw = false;
+	try {
+		c.getOrLoad(1, [](int) -> int { throw std::runtime_error("backend down"); });
+	} catch (const std::runtime_error&) {
+		threw = true;
+	}
+	assert(threw && !c.contains(1));
+	assert(c.getOrLoad(1, [](int k) { return k + 1; }) == 2 && c.get(1) == 2);
+	std::cout << "... getOrLoad ok" << std::endl;
+}
+
+// a lock that counts exclusive and shared acquisitions
+struct CountingRWLock {
+	static int exclusive, shared;
+	void lock() { ++exclusive; }
+	bool try_lock() { ++exclusive; return true; }
+	void unlock() {}
+	void lock_shared() { ++shared; }
+	void unlock_shared() {}
+};
+int CountingRWLock::exclusive = 0;
+int CountingRWLock::shared = 0;
+
+// Test peek: no promotion, and the probes take the shared lock
+void testPeek() {
+	typedef Cache<int, int, CountingRWLock> RWCache;
+	RWCache c(3, 0);
+	c.insert(1, 1);
+	c.insert(2, 2);
+	c.insert(3, 3);
+	const int writes = CountingRWLock::exclusive;
+	int v = 0;
+	assert(c.tryPeek(1, v) && v == 1 && c.peek(2) == 2 && !c.tryPeek(4, v));
+	assert(c.contains(3) && c.size() == 3);
+	size_t walked = 0;
+	auto count = [&walked](const RWCache::node_type&) { ++walked; };
+	c.cwalk(count);
+	assert(walked == 3 && CountingRWLock::exclusive == writes);
+	assert(CountingRWLock::shared == 6);
+	bool threw = false;
+	try {
+		c.peek(4);
+	} catch (const KeyNotFound&) {
+		threw = true;
+	}
+	assert(threw);
+	// 1 was only peeked, so it is still the LRU entry
+	c.insert(4, 4);
+	assert(!c.contains(1) && c.contains(2));
+	// a get does promote
+	c.get(2);
+	c.insert(5, 5);
+	assert(c.contains(2) && !c.contains(3));
+
+	ShardedCache<int, int, std::mutex> sc(16, 0, 4);
+	sc.insert(7, 7);
+	assert(sc.peek(7) == 7 && sc.tryPeek(7, v) && v == 7);
+	PooledCache<int, int> pc(3, 0);
+	pc.insert(1, 1);
+	pc.insert(2, 2);
+	pc.insert(3, 3);
+	assert(pc.peek(1) == 1);
+	pc.insert(4, 4);
+	assert(!pc.contains(1));
+	std::cout << "... peek ok" << std::endl;
+}
+
+// Test setPruneBudget / maintain: eviction work is spread over the inserts
+void testPruneBudget() {
+	Cache<int, int> classic(10, 10);
+	Cache<int, int> bounded(10, 10);
+	bounded.setPruneBudget(3);
+	for (int i = 0; i < 20; i++) {
+		classic.insert(i, i);
+		bounded.insert(i, i);
+	}
+	// the 20th insert reached the hard limit
+	assert(classic.size() == 10 && bounded.size() == 17);
+	size_t last = bounded.size();
+	for (int i = 20; i < 24; i++) {
+		bounded.insert(i, i);
+		// at most 3 evictions per insert
+		assert(bounded.size() + 3 >= last + 1 && bounded.size() >= 10);
+		last = bounded.size();
+	}
+	// drained back to maxSize, the oldest entries went first
+	assert(bounded.size() == 10 && bounded.contains(14) && !bounded.contains(13));
+	bounded.insert(24, 24);
+	assert(bounded.size() == 11);
+
+	Cache<int, int> holding(10, 10);
+	holding.setPruneBudget(1);
+	for (int i = 0; i < 50; i++) {
+		holding.insert(i, i);
+	}
+	assert(holding.size() == 19);
+
+	// a maintenance step trims below the hard limit
+	PooledCache<int, int> pc(10, 10);
+	for (int i = 0; i < 15; i++) {
+		pc.insert(i, i);
+	}
+	assert(pc.maintain(2) == 2 && pc.size() == 13);
+	assert(pc.maintain(100) == 3 && pc.size() == 10 && pc.maintain(100) == 0);
+	assert(!pc.contains(4) && pc.contains(5));
+	assert(holding.maintain(4) == 4 && holding.size() == 15);
+	std::cout << "... prune budget ok" << std::endl;
+}
+
+// Test saveSnapshot / loadSnapshot: a warm start restores entries and order
+void testSnapshot() {
+	const std::string path = "lru11_snapshot_test.bin";
+	Cache<int, std::string> c(4, 0);
+	for (int i = 0; i < 4; i++) {
+		c.insert(i, std::string(i, 'x'));
+	}
+	c.get(0);  // MRU -> LRU is now 0 3 2 1
+	assert(c.saveSnapshot(path) == 4);
+
+	Cache<int, std::string> warm(4, 0);
+	assert(warm.loadSnapshot(path) == 4 && warm.get(3) == "xxx" && warm.get(0).empty());
+	std::vector<int> order;
+	auto collect = [&order](const Cache<int, std::string>::node_type& n) { order.push_back(n.key); };
+	warm.cwalk(collect);
+	assert((order == std::vector<int>{0, 3, 2, 1}));
+	// a smaller cache keeps the most recent entries
+	Cache<int, std::string> small(2, 0);
+	assert(small.loadSnapshot(path) == 2 && small.contains(0) && small.contains(3) && !small.contains(1));
+
+	ShardedCache<int, std::string, std::mutex> sc(64, 8, 4);
+	assert(sc.loadSnapshot(path) == 4 && sc.get(2) == "xx");
+	assert(sc.saveSnapshot(path) == 4 && warm.loadSnapshot(path) == 4);
+	// every shard keeps its own most recent entries, up to its maxSize
+	Cache<int, std::string> big(1000, 0);
+	for (int i = 0; i < 1000; i++) {
+		big.insert(i, "v");
+	}
+	assert(big.saveSnapshot(path) == 1000);
+	ShardedCache<int, std::string, std::mutex> capped(100, 0, 4);
+	assert(capped.loadSnapshot(path) == 100 && capped.size() == 100);
+	assert(capped.contains(999) && !capped.contains(0));
+	// a ShardedCache snapshot interleaves its shards, so a prefix of it is
+	// the most recent entries of every shard, not whole leading shards
+	assert(capped.saveSnapshot(path) == 100);
+	Cache<int, std::string> head(40, 0);
+	assert(head.loadSnapshot(path) == 40);
+	std::vector<int> loaded;
+	auto keys = [&loaded](const Cache<int, std::string>::node_type& n) { loaded.push_back(n.key); };
+	head.cwalk(keys);
+	for (int k : loaded) {
+		assert(k >= 940);
+	}
+
+	// a truncated or foreign file is rejected
+	FILE* f = std::fopen(path.c_str(), "wb");
+	std::fputs("LRU11SN1", f);
+	std::fclose(f);
+	bool threw = false;
+	try {
+		warm.loadSnapshot(path);
+	} catch (const SnapshotError&) {
+		threw = true;
+	}
+	assert(threw);
+	std::remove(path.c_str());
+	threw = false;
+	try {
+		warm.loadSnapshot(path);
+	} catch (const SnapshotError&) {
+		threw = true;
+	}
+	assert(threw);
+	std::cout << "... snapshot ok" << std::endl;
+}
+
+// Test TieredCache: tier 1 evictions spill to the file and come back
+void testTiered() {
+	const std::string path = "lru11_spill_test.bin";
+	{
+		// 4 regions of 64 bytes, each record is 1 + 4 + 1 + 7 bytes
+		TieredCache<int, std::string> tc(4, 0, path, 256, 64);
+		for (int i = 0; i < 12; i++) {
+			tc.insert(i, "value " + std::to_string(i % 10));
+		}
+		assert(tc.size() == 4 && tc.spilledSize() == 8);
+		assert(tc.contains(0) && !tc.contains(12));
+		// 0..3 fill the first region and were written out, 4..7 sit in the
+		// open region
+		assert(tc.spill().bytesWritten() == 4 * 13);
+		assert(tc.get(0) == "value 0" && tc.get(5) == "value 5");
+		assert(tc.spillHits() == 2 && tc.memory().contains(0) && !tc.spill().contains(0));
+		// a replaced or removed key leaves the spill file too
+		tc.insert(1, "fresh");
+		assert(tc.get(1) == "fresh");
+		assert(tc.remove(2) && !tc.contains(2));
+		std::string v;
+		assert(!tc.tryGet(100, v));
+
+		// the oldest regions are recycled once the ring wraps around
+		for (int i = 100; i < 200; i++) {
+			tc.insert(i, "value x");
+		}
+		assert(!tc.contains(3) && tc.contains(199) && tc.spilledSize() <= 4 * 4);
+		assert(tc.get(195) == "value x");
+	}
+	{
+		// a key removed while its eviction is on the way to the spill file
+		// must stay removed
+		TieredCache<int, std::string, std::mutex> tc(8, 0, path, 1 << 16, 1 << 12);
+		const int n = 20000;
+		std::atomic<int> inserted(-1);
+		std::thread writer([&]() {
+			for (int i = 0; i < n; i++) {
+				tc.insert(i, "v");
+				inserted.store(i);
+			}
+		});
+		std::thread remover([&]() {
+			for (int i = 0; i < n; i += 2) {
+				while (inserted.load() < i) {
+					std::this_thread::yield();
+				}
+				tc.remove(i);
+			}
+		});
+		writer.join();
+		remover.join();
+		std::string v;
+		for (int i = 0; i < n; i += 2) {
+			assert(!tc.tryGet(i, v));
+		}
+	}
+	std::remove(path.c_str());
+	std::cout << "... tiered ok" << std::endl;
+}
+
+// Test Policies: named features, and the ones left out cost nothing
+void testPolicies() {
+	typedef Cache<int, int, Policies<>> Plain;
+	static_assert(std::is_same<Plain::cache_type, Cache<int, int>>::value, "defaults");
+	static_assert(sizeof(Plain::node_type) == sizeof(KeyValuePair<int, int>), "bare node");
+	static_assert(sizeof(Cache<int, int>::node_type) == sizeof(KeyValuePair<int, int>), "bare node");
+	typedef Cache<std::string, int, Policies<UseLock<std::mutex>, UseExpiry<TimedExpiry<ManualClock>>,
+	                                         UseStats<AtomicStats<>>>> Timed;
+	static_assert(std::is_same<Timed::lock_type, std::mutex>::value, "lock");
+	static_assert(sizeof(Timed::node_type) > sizeof(KeyValuePair<std::string, int>), "ttl node");
+	static_assert(std::is_same<Cache<int, int, Policies<UseEviction<ClockPolicy>>>::policy_type,
+	                           Cache<int, int, NullLock, std::unordered_map<int, int>, ClockPolicy>::policy_type>::value,
+	              "policy");
+
+	Timed tc(10, 2);
+	tc.insert("a", 1, std::chrono::milliseconds(10));
+	assert(tc.get("a") == 1);
+	ManualClock::nowMs += 20;
+	assert(!tc.contains("a") && tc.getStats().hits == 1);
+
+	ShardedCache<int, int, Policies<UseLock<std::mutex>, UseEviction<TinyLFUPolicy>>> sc(64, 8, 4);
+	sc.insert(1, 1);
+	assert(sc.get(1) == 1);
+	std::cout << "... policies ok" << std::endl;
+}
+
+// Test CompactCache: same LRU semantics, arrays instead of nodes
+// InlineString keys looked up by const char*
+struct NameHash {
+	typedef void is_transparent;
+	size_t operator()(const InlineString<15>& s) const { return detail::hashBytes(s.data(), s.size()); }
+	size_t operator()(const char* s) const { return detail::hashBytes(s, strlen(s)); }
+};
+struct NameEqual {
+	typedef void is_transparent;
+	bool operator()(const InlineString<15>& a, const InlineString<15>& b) const { return a == b; }
+	bool operator()(const InlineString<15>& a, const char* b) const { return a.str() == b; }
+	bool operator()(const char* a, const InlineString<15>& b) const { return b.str() == a; }
+};
+void testCompact() {
+	CompactCache<uint64_t, uint32_t> cc(3, 0);
+	cc.insert(1, 10);
+	cc.insert(2, 20);
+	cc.insert(3, 30);
+	assert(cc.get(1) == 10);
+	cc.insert(4, 40);
+	assert(!cc.contains(2) && cc.contains(1) && cc.size() == 3);
+	assert(!cc.insert_or_assign(4, 41) && cc.peek(4) == 41);
+	assert(cc.remove(3) && !cc.remove(3) && cc.size() == 2);
+	std::vector<uint64_t> order;
+	auto collect = [&order](const KeyValuePair<uint64_t, uint32_t>& n) { order.push_back(n.key); };
+	cc.cwalk(collect);
+	assert((order == std::vector<uint64_t>{4, 1}));
+
+	// elasticity: grows to 15 and is pruned back to 10, LRU first
+	CompactCache<uint64_t, uint32_t> big(10, 5);
+	for (uint64_t i = 0; i < 15; i++) {
+		big.insert(i, static_cast<uint32_t>(i));
+	}
+	assert(big.size() == 10 && !big.contains(4) && big.contains(5));
+	assert(big.memoryUsage() < 15 * 40);
+
+	typedef InlineString<15> Name;
+	static_assert(sizeof(Name) == 16, "inline layout");
+	CompactCache<Name, int, std::mutex> names(4, 1);
+	names.insert("alice", 1);
+	names.insert(std::string("bob"), 2);
+	assert(names.get("alice") == 1 && names.get(Name("bob")) == 2 && !names.contains("al"));
+	assert(Name("bob").str() == "bob" && Name("ab") < Name("abc"));
+	bool threw = false;
+	try {
+		names.insert("a name longer than fifteen", 3);
+	} catch (const std::length_error&) {
+		threw = true;
+	}
+	assert(threw);
+
+	// the rest of PooledCache's API
+	CompactCache<uint64_t, uint32_t> more(10, 5);
+	assert(more.emplace(1, 10u) && !more.emplace(1, 11u) && more.peek(1) == 10);
+	std::vector<std::pair<uint64_t, uint32_t>> items;
+	for (uint64_t i = 2; i < 12; i++) {
+		items.emplace_back(i, static_cast<uint32_t>(i * 10));
+	}
+	more.insertMany(items);
+	std::vector<uint64_t> wanted{1, 5, 99};
+	std::vector<uint32_t> values;
+	std::vector<bool> found;
+	assert(more.getMany(wanted, values, found) == 2 && found[1] && !found[2] && values[1] == 50);
+	more.setPruneBudget(2);
+	for (uint64_t i = 20; i < 24; i++) {
+		more.insert(i, 0);
+	}
+	// the hard limit of 15 is reached, each insert evicts at most 2 after it
+	assert(more.size() == 13 && more.checkInvariants());
+	assert(more.maintain(100) == 3 && more.size() == 10 && more.checkInvariants());
+
+	CompactCache<Name, int, NullLock, NameHash, NameEqual> tn(4, 0);
+	tn.insert("carol", 3);
+	const char* carol = "carol";
+	int v = 0;
+	assert(tn.tryGet(carol, v) && v == 3 && tn.contains(carol) && tn.peek(carol) == 3);
+	assert(tn.remove(carol) && !tn.contains(carol));
+	std::cout << "... compact ok" << std::endl;
+}
+
+// a stateful allocator counting the live allocations of one "arena"
+template <class T>
+struct CountingAlloc {
+	typedef T value_type;
+	explicit CountingAlloc(int* live) : live(live) {}
+	template <class U>
+	CountingAlloc(const CountingAlloc<U>& o) : live(o.live) {}
+	T* allocate(size_t n) {
+		++*live;
+		return static_cast<T*>(::operator new(n * sizeof(T)));
+	}
+	void deallocate(T* p, size_t) {
+		--*live;
+		::operator delete(p);
+	}
+	template <class U>
+	bool operator==(const CountingAlloc<U>& o) const { return live == o.live; }
+	template <class U>
+	bool operator!=(const CountingAlloc<U>& o) const { return live != o.live; }
+	int* live;
+};
+
+// Test Allocator: list and map nodes both come from the cache's allocator
+void testAllocator() {
+	int live = 0;
+	{
+		typedef Cache<int, int, NullLock, std::unordered_map<int, int>, LRUPolicy, NoWeigher, NoExpiry,
+		              NoStats, CountingAlloc<char>> ACache;
+		ACache c(4, 0, 0, NoWeigher(), CountingAlloc<char>(&live));
+		std::vector<int> removed;
+		c.setRemovalListener([&removed](const int& k, int&, RemovalCause) { removed.push_back(k); });
+		for (int i = 0; i < 8; i++) {
+			c.insert(i, i);
+		}
+		// 4 list nodes + 4 map nodes + the bucket array
+		assert(c.size() == 4 && removed.size() == 4 && live >= 9);
+		c.insert(7, 70);
+		assert(c.get(7) == 70 && removed.size() == 5);
+
+		Cache<int, int, std::mutex, std::map<int, int>, LRUPolicy, NoWeigher, NoExpiry, NoStats,
+		      CountingAlloc<char>> mc(4, 0, 0, NoWeigher(), CountingAlloc<char>(&live));
+		const int before = live;
+		mc.insert(1, 1);
+		assert(live == before + 2);
+
+		ShardedCache<int, int, Policies<UseLock<std::mutex>, UseAllocator<CountingAlloc<char>>>> sc(
+		    64, 8, 4, 0, std::hash<int>(), NoWeigher(), CountingAlloc<char>(&live));
+		const int beforeSharded = live;
+		sc.insert(1, 1);
+		assert(live >= beforeSharded + 2);
+	}
+	assert(live == 0);
+	std::cout << "... allocator ok" << std::endl;
+}
+
+void testNuma() {
+	assert(lru11::detail::parseCpuList("0-3,8,10-11\n").size() == 7);
+	// more groups than nodes: each node's cpus are split, even when the cpu
+	// ids of the nodes interleave (node0 = 0-3,8-11, node1 = 4-7,12-15)
+	std::vector<size_t> cpuNode(16);
+	for (size_t cpu = 0; cpu < 16; cpu++) {
+		cpuNode[cpu] = (cpu / 4) % 2;
+	}
+	assert((lru11::detail::cpuGroups(cpuNode, 4) ==
+	        std::vector<size_t>{0, 0, 0, 0, 2, 2, 2, 2, 1, 1, 1, 1, 3, 3, 3, 3}));
+	const std::vector<size_t> three = lru11::detail::cpuGroups(cpuNode, 3);
+	for (size_t cpu = 0; cpu < 16; cpu++) {
+		assert(three[cpu] == (cpuNode[cpu] == 0 ? (cpu < 8 ? 0u : 1u) : 2u));
+	}
+	assert((lru11::detail::cpuGroups(cpuNode, 2) == cpuNode));
+	int live[2] = {0, 0};
+	{
+		size_t current = 0;
+		typedef NumaShardedCache<int, int, std::mutex, std::mutex, std::hash<int>, CountingAlloc<char>> NCache;
+		NCache c(4, 0, 8, 2, 1, [&live](size_t g) { return CountingAlloc<char>(&live[g]); },
+		         [&current]() { return current; });
+		assert(c.groupCount() == 2);
+		for (int i = 1; i <= 4; i++) {
+			c.insert(i, i);
+		}
+		assert(c.group(0).size() == 4 && c.group(1).size() == 0 && live[0] > 0 && live[1] == 0);
+
+		// a peer hit is copied into the caller's group
+		current = 1;
+		assert(c.get(1) == 1 && c.group(1).contains(1) && c.group(0).contains(1) && live[1] > 0);
+		// a write drops the other groups' copies
+		c.insert(1, 10);
+		assert(!c.group(0).contains(1) && c.group(1).size() == 1);
+		current = 0;
+		assert(c.get(1) == 10 && c.group(0).size() == 4);
+
+		// size evictions go to the shared victim tier
+		c.insert(5, 5);
+		assert(c.group(0).size() == 4 && c.victimSize() == 1 && c.victim().contains(2));
+		current = 1;
+		assert(c.get(2) == 2 && c.group(1).contains(2));
+
+		assert(c.remove(2) && !c.contains(2) && c.victimSize() == 0);
+		int v = 0;
+		assert(!c.tryGet(2, v));
+	}
+	assert(live[0] == 0 && live[1] == 0);
+
+	NumaShardedCache<int, int> d(16, 4, 16);
+	assert(d.groupCount() >= 1 && d.currentGroup() < d.groupCount());
+	d.insert(1, 1);
+	assert(d.get(1) == 1);
+	std::cout << "... numa ok" << std::endl;
+}
+
+void testBeginLoad() {
+	Cache<int, int, std::mutex> c(8, 0);
+	int v = 0;
+	int woken = 0;
+	auto waiter = [&woken](const std::shared_future<int>& f) { woken += f.get(); };
+	assert(c.beginLoad(1, v, waiter) == LoadState::kLoad);
+	assert(c.beginLoad(1, v, waiter) == LoadState::kWait);
+	assert(c.beginLoad(2, v, waiter, false) == LoadState::kMiss);
+	c.endLoad(1, 5);
+	assert(woken == 5 && c.beginLoad(1, v, waiter) == LoadState::kHit && v == 5);
+
+	bool failed = false;
+	assert(c.beginLoad(3, v, nullptr) == LoadState::kLoad);
+	c.beginLoad(3, v, [&failed](const std::shared_future<int>& f) {
+		try {
+			f.get();
+		} catch (const std::runtime_error&) {
+			failed = true;
+		}
+	});
+	c.failLoad(3, std::make_exception_ptr(std::runtime_error("backend_down")));
+	assert(failed && !c.contains(3));
+	// a blocking getOrLoad() after the failure loads again
+	assert(c.getOrLoad(3, [](int k) { return k; }) == 3);
+	std::cout << "... beginLoad ok" << std::endl;
+}
+
+#if __cplusplus >= 202002L && defined(__cpp_impl_coroutine)
+struct Spawn {
+	struct promise_type {
+		Spawn get_return_object() { return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+	};
+};
+// an "rpc" that completes when the test resumes it
+std::vector<std::coroutine_handle<>> pendingIo;
+struct DeferredLoad {
+	int v;
+	bool await_ready() { return false; }
+	void await_suspend(std::coroutine_handle<> h) { pendingIo.push_back(h); }
+	int await_resume() {
+		if (v < 0) {
+			throw std::runtime_error("backend_down");
+		}
+		return v;
+	}
+};
+typedef Cache<int, int, std::mutex> ACache;
+Spawn loadInto(ACache& c, int k, int* out) {
+	*out = co_await getOrLoadAsync(c, k, [](int key) { return DeferredLoad{key * 10}; });
+}
+Spawn peekInto(ACache& c, int k, int* out) {
+	std::optional<int> v = co_await getAsync(c, k);
+	*out = v ? *v : -1;
+}
+Spawn failInto(ACache& c, int k, int* out) {
+	try {
+		co_await getOrLoadAsync(c, k, [](int) { return DeferredLoad{-1}; });
+	} catch (const std::runtime_error&) {
+		*out = -2;
+	}
+}
+
+void testAsync() {
+	ACache c(8, 0);
+	int a = 0, b = 0, g = 0;
+	loadInto(c, 1, &a);
+	loadInto(c, 1, &b);
+	peekInto(c, 1, &g);
+	// one load in flight, all three callers suspended on it
+	assert(pendingIo.size() == 1 && a == 0 && b == 0 && g == 0);
+	pendingIo.back().resume();
+	pendingIo.clear();
+	assert(a == 10 && b == 10 && g == 10 && c.get(1) == 10);
+
+	// hits and inline loaders complete without suspending
+	int hit = 0, inl = 0, missing = 0;
+	loadInto(c, 1, &hit);
+	[](ACache& cc, int* out) -> Spawn { *out = co_await getOrLoadAsync(cc, 2, [](int k) { return k; }); }(c, &inl);
+	peekInto(c, 3, &missing);
+	assert(pendingIo.empty() && hit == 10 && inl == 2 && missing == -1);
+
+	int f1 = 0, f2 = 0;
+	failInto(c, 4, &f1);
+	failInto(c, 4, &f2);
+	assert(pendingIo.size() == 1);
+	pendingIo.back().resume();
+	pendingIo.clear();
+	assert(f1 == -2 && f2 == -2 && !c.contains(4));
+	std::cout << "... async ok" << std::endl;
+}
+#endif
+
+void testResize() {
+	Cache<int, int> c(10, 2);
+	for (int i = 0; i < 10; i++) {
+		c.insert(i, i);
+	}
+	// without a prune budget a shrink evicts the excess at once
+	c.setMaxSize(4);
+	assert(c.size() == 4 && c.getMaxSize() == 4 && !c.contains(5) && c.contains(6));
+	c.setMaxSize(8);
+	for (int i = 10; i < 14; i++) {
+		c.insert(i, i);
+	}
+	assert(c.size() == 8);
+
+	// with one it drains budget entries per call
+	c.setPruneBudget(2);
+	c.setMaxSize(2);
+	assert(c.size() == 6);
+	assert(c.maintain(2) == 2 && c.size() == 4);
+	c.insert(20, 20);
+	assert(c.size() == 3);
+	c.insert(21, 21);
+	assert(c.size() == 2);
+	c.insert(22, 22);
+	assert(c.size() == 3);
+	c.setElasticity(0);
+	assert(c.size() == 2 && c.getMaxAllowedSize() == 2 && c.contains(21) && c.contains(22));
+
+	Cache<int, int> r(1000, 0);
+	r.reserve(r.getMaxAllowedSize());
+	for (int i = 0; i < 2000; i++) {
+		r.insert(i, i);
+	}
+	assert(r.size() == 1000 && r.contains(1999));
+
+	Cache<int, int, NullLock, std::unordered_map<int, int>, TinyLFUPolicy> t(100, 0);
+	for (int i = 0; i < 100; i++) {
+		t.insert(i, i);
+	}
+	t.setMaxSize(1000);
+	for (int i = 100; i < 600; i++) {
+		t.insert(i, i);
+	}
+	assert(t.size() == 600);
+	t.setMaxSize(10);
+	size_t walked = 0;
+	auto count = [&walked](const KeyValuePair<int, int>&) { ++walked; };
+	t.cwalk(count);
+	assert(t.size() == 10 && walked == 10);
+	t.insert(1000, 1000);
+	assert(t.size() == 10);
+
+	ShardedCache<int, int, std::mutex> sc(64, 8, 4);
+	for (int i = 0; i < 64; i++) {
+		sc.insert(i, i);
+	}
+	sc.setMaxSize(16);
+	sc.reserve(64);
+	assert(sc.getMaxSize() == 16 && sc.size() <= 16);
+	std::cout << "... resize ok" << std::endl;
+}
+
+std::string tenantKey(const char* tenant, int i) {
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%s/%04d", tenant, i);
+	return buf;
+}
+
+void testOrdered() {
+	typedef Cache<std::string, int, std::mutex, BTreeMap<std::string, int>> BCache;
+	BCache c(10000, 0);
+	size_t removed = 0;
+	c.setRemovalListener([&removed](const std::string&, int&, RemovalCause cause) {
+		assert(cause == RemovalCause::kExplicit);
+		++removed;
+	});
+	for (int i = 0; i < 1000; i++) {
+		c.insert(tenantKey("a", i), i);
+		c.insert(tenantKey("b", i), i);
+		c.insert(tenantKey("ab", i), i);
+	}
+	assert(c.size() == 3000);
+	assert(c.removePrefix("a/") == 1000 && removed == 1000 && c.size() == 2000);
+	assert(!c.contains(tenantKey("a", 5)) && c.contains(tenantKey("ab", 5)));
+	assert(c.removeRange(tenantKey("b", 100), tenantKey("b", 200)) == 100);
+	assert(!c.contains(tenantKey("b", 150)) && c.contains(tenantKey("b", 99)) && c.contains(tenantKey("b", 200)));
+	assert(c.removeRange("x", "y") == 0 && c.size() == 1900);
+
+	// still an LRU cache
+	Cache<int, int, NullLock, BTreeMap<int, int>> lru(3, 0);
+	lru.insert(1, 1);
+	lru.insert(2, 2);
+	lru.insert(3, 3);
+	lru.get(1);
+	lru.insert(4, 4);
+	assert(lru.contains(1) && !lru.contains(2) && lru.removeRange(3, 5) == 2 && lru.size() == 1);
+
+	Cache<std::string, int, NullLock, std::map<std::string, int>> m(100, 0);
+	m.insert("u1:x", 1);
+	m.insert("u1:y", 2);
+	m.insert("u2:x", 3);
+	assert(m.removePrefix("u1:") == 2 && m.size() == 1);
+
+	ShardedCache<std::string, int, std::mutex, BTreeMap<std::string, int>> sc(4000, 0, 8);
+	for (int i = 0; i < 1000; i++) {
+		sc.insert(tenantKey("a", i), i);
+		sc.insert(tenantKey("b", i), i);
+	}
+	assert(sc.removePrefix("b/") == 1000 && sc.size() == 1000);
+
+	int live = 0;
+	{
+		Cache<int, int, NullLock, BTreeMap<int, int>, LRUPolicy, NoWeigher, NoExpiry, NoStats,
+		      CountingAlloc<char>> ac(500, 0, 0, NoWeigher(), CountingAlloc<char>(&live));
+		for (int i = 0; i < 2000; i++) {
+			ac.insert(i, i);
+		}
+		assert(live > 500 && ac.size() == 500 && ac.removeRange(1500, 1600) == 100);
+	}
+	assert(live == 0);
+	std::cout << "... ordered ok" << std::endl;
+}
+
+// big enough that BTreeMap nodes get the minimum of 4 slots, so merges,
+// borrows and collapses happen every few operations
+struct BigKey {
+	int v;
+	char pad[124];
+	BigKey(int x = 0) : v(x) { std::memset(pad, 0, sizeof(pad)); }
+	bool operator<(const BigKey& o) const { return v < o.v; }
+};
+
+void testBTreeRandom() {
+	for (unsigned seed = 0; seed < 20; seed++) {
+		std::minstd_rand rng(seed + 1);
+		BTreeMap<BigKey, int> b;
+		std::map<int, int> m;
+		for (int step = 0; step < 3000; step++) {
+			const int k = static_cast<int>(rng() % 400);
+			const unsigned op = rng() % 10;
+			if (op < 5) {
+				const bool added = b.try_emplace(BigKey(k), step).second;
+				assert(added == m.emplace(k, step).second);
+			} else if (op < 8) {
+				assert(b.erase(BigKey(k)) == m.erase(k));
+			} else if (op < 9) {
+				const int hi = k + static_cast<int>(rng() % 60);
+				auto it = b.erase(b.lower_bound(BigKey(k)), b.lower_bound(BigKey(hi)));
+				auto mit = m.erase(m.lower_bound(k), m.lower_bound(hi));
+				assert(mit == m.end() ? it == b.end() : it != b.end() && it->first.v == mit->first);
+			} else {
+				auto it = b.lower_bound(BigKey(k));
+				auto mit = m.lower_bound(k);
+				assert(mit == m.end() ? it == b.end() : it != b.end() && it->first.v == mit->first);
+			}
+			assert(b.size() == m.size());
+			auto mit = m.begin();
+			for (auto it = b.begin(); it != b.end(); ++it, ++mit) {
+				assert(mit != m.end() && it->first.v == mit->first && it->second == mit->second);
+			}
+			assert(mit == m.end());
+		}
+	}
+
+	// the same through Cache::removeRange()
+	Cache<BigKey, int, NullLock, BTreeMap<BigKey, int>> c(500, 0);
+	for (int i = 0; i < 1000; i++) {
+		c.insert(BigKey(i), i);
+	}
+	for (int lo = 500; lo < 1000; lo += 7) {
+		c.removeRange(BigKey(lo), BigKey(lo + 5));
+		assert(c.checkInvariants());
+	}
+	assert(c.size() == 500 - 71 * 5 - 3);
+	std::cout << "... btree ok" << std::endl;
+}
+
 int main(int argc, char** argv) {
 
 	testNoLock();
 	testWithLock();
+	testSharded();
+	testPooled();
+	testBufferedLRU();
+	testClock();
+	testTinyLFU();
+	testWeighted();
+	testExpiry();
+	testRefresh();
+	testRemovalListener();
+	testStats();
+	testTransparent();
+	testMoveInsert();
+	testValueHandle();
+	testBatch();
+	testGetOrLoad();
+	testPeek();
+	testPruneBudget();
+	testSnapshot();
+	testTiered();
+	testPolicies();
+	testCompact();
+	testAllocator();
+	testNuma();
+	testBeginLoad();
+	testResize();
+	testOrdered();
+	testBTreeRandom();
+#if __cplusplus >= 202002L && defined(__cpp_impl_coroutine)
+	testAsync();
+#endif
 	return 0;
 }
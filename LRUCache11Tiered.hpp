@@ -0,0 +1,407 @@
+/*
+ * LRUCache11 - a templated C++11 based LRU cache class that allows
+ * specification of
+ * key, value and optionally the map container type (defaults to
+ * std::unordered_map)
+ *
+ * LRUCache11Tiered.hpp - a two tier cache for working sets larger than RAM.
+ * Tier 1 is a regular lru11::Cache. The entries it evicts for size are
+ * handed over by its removal listener (batched, after its lock is released)
+ * to tier 2, a log-structured spill file on local SSD / NVMe with an
+ * in-memory key -> offset index. Misses in tier 1 are looked up in tier 2
+ * with pread() before the caller goes to the backend.
+ *
+ * Github: https://github.com/mohaps/lrucache11
+ *
+ * Copyright (c) 2012-22 SAURAV MOHAPATRA <mohaps@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#pragma once
+#include <cerrno>
+#include <string>
+#include <vector>
+
+#include "LRUCache11.hpp"
+
+#ifndef LRU11_HAVE_MMAP
+#error "LRUCache11Tiered.hpp needs POSIX pread() / pwrite()"
+#endif
+
+namespace lru11 {
+
+namespace detail {
+inline bool preadAll(int fd, char* p, size_t n, uint64_t offset) {
+  while (n != 0) {
+    const ssize_t r = ::pread(fd, p, n, static_cast<off_t>(offset));
+    if (r < 0 && errno == EINTR) {
+      continue;
+    }
+    if (r <= 0) {
+      return false;
+    }
+    p += r;
+    n -= static_cast<size_t>(r);
+    offset += static_cast<uint64_t>(r);
+  }
+  return true;
+}
+inline bool pwriteAll(int fd, const char* p, size_t n, uint64_t offset) {
+  while (n != 0) {
+    const ssize_t r = ::pwrite(fd, p, n, static_cast<off_t>(offset));
+    if (r < 0 && errno == EINTR) {
+      continue;
+    }
+    if (r <= 0) {
+      return false;
+    }
+    p += r;
+    n -= static_cast<size_t>(r);
+    offset += static_cast<uint64_t>(r);
+  }
+  return true;
+}
+}  // namespace detail
+
+/**
+ *	The spill tier of TieredCache: a file of maxBytes / regionBytes fixed
+ *size regions used as a ring. Entries (encoded like snapshot records, see
+ *SnapshotSerializer) are appended to the open region in memory. A full
+ *region is written with a single pwrite() and the next region is recycled,
+ *dropping the entries it held, so the device only sees large sequential
+ *writes and the oldest spilled entries are evicted first (FIFO).
+ *
+ *	In memory are the index, per spilled key the key itself and a 12 byte
+ *extent, the open region and, per region, the keys appended to it (a second
+ *copy of each key, used to drop the region's index entries when it is
+ *recycled). Reads of sealed regions pread() outside the lock and are
+ *validated against the region's generation afterwards. The file is scratch
+ *space; it is truncated when opened and not meant to survive a restart.
+ */
+template <class Key, class Value, class Lock = NullLock,
+          class Serializer = SnapshotSerializer<Key, Value>,
+          class Hash = std::hash<Key>>
+class SpillFile {
+ public:
+  typedef Lock lock_type;
+  using Guard = std::lock_guard<lock_type>;
+
+  SpillFile(const std::string& path, size_t maxBytes, size_t regionBytes,
+            const Serializer& s = Serializer(), const Hash& hash = Hash())
+      : regionBytes_(regionBytes),
+        serializer_(s),
+        index_(16, hash),
+        open_(0),
+        bytesWritten_(0),
+        dropped_(0) {
+    if (regionBytes_ == 0 || regionBytes_ > 0xffffffffu ||
+        maxBytes / regionBytes_ < 2) {
+      throw std::invalid_argument("spill_file_too_small");
+    }
+    regions_.resize(maxBytes / regionBytes_);
+    buf_.reserve(regionBytes_);
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd_ < 0) {
+      throw std::runtime_error("spill_open_failed");
+    }
+  }
+  ~SpillFile() { ::close(fd_); }
+
+  /**
+   * appends k / v to the open region, replacing any older spilled copy of
+   * k. never throws: an entry larger than a region, a failed encode or a
+   * failed write just drops entries (see dropped())
+   */
+  void append(const Key& k, const Value& v) {
+    try {
+      Guard g(lock_);
+      record_.clear();
+      detail::putSnapshotRecord(record_, scratch_, serializer_, k, v);
+      if (record_.size() > regionBytes_) {
+        ++dropped_;
+        return;
+      }
+      if (buf_.size() + record_.size() > regionBytes_) {
+        seal_nolock();
+      }
+      const Extent e = {static_cast<uint32_t>(open_),
+                        static_cast<uint32_t>(buf_.size()),
+                        static_cast<uint32_t>(record_.size())};
+      buf_ += record_;
+      regions_[open_].keys.push_back(k);
+      index_[k] = e;
+    } catch (...) {
+      ++dropped_;
+    }
+  }
+  /**
+   * reads k into vOut and removes it from the spill tier (the caller
+   * promotes it). false if k is not spilled, or its region was recycled or
+   * k was replaced / removed while it was being read
+   */
+  bool take(const Key& k, Value& vOut) {
+    std::unique_lock<lock_type> g(lock_);
+    auto iter = index_.find(k);
+    if (iter == index_.end()) {
+      return false;
+    }
+    const Extent e = iter->second;
+    if (e.region == open_) {
+      index_.erase(iter);
+      return decode(k, buf_.data() + e.offset, e.size, vOut);
+    }
+    const uint64_t generation = regions_[e.region].generation;
+    g.unlock();
+    std::string record(e.size, '\0');
+    if (!detail::preadAll(fd_, &record[0], e.size,
+                          uint64_t(e.region) * regionBytes_ + e.offset)) {
+      return false;
+    }
+    g.lock();
+    iter = index_.find(k);
+    if (regions_[e.region].generation != generation ||
+        iter == index_.end() || !(iter->second == e)) {
+      return false;
+    }
+    index_.erase(iter);
+    g.unlock();
+    return decode(k, record.data(), record.size(), vOut);
+  }
+  bool erase(const Key& k) {
+    Guard g(lock_);
+    return index_.erase(k) != 0;
+  }
+  bool contains(const Key& k) const {
+    Guard g(lock_);
+    return index_.find(k) != index_.end();
+  }
+  // the number of spilled entries
+  size_t size() const {
+    Guard g(lock_);
+    return index_.size();
+  }
+  size_t getMaxBytes() const { return regions_.size() * regionBytes_; }
+  size_t getRegionBytes() const { return regionBytes_; }
+  uint64_t bytesWritten() const {
+    Guard g(lock_);
+    return bytesWritten_;
+  }
+  // entries dropped without being spilled (too large, failed writes)
+  uint64_t dropped() const {
+    Guard g(lock_);
+    return dropped_;
+  }
+
+ private:
+  struct Extent {
+    uint32_t region;
+    uint32_t offset;
+    uint32_t size;
+    bool operator==(const Extent& o) const {
+      return region == o.region && offset == o.offset && size == o.size;
+    }
+  };
+  struct Region {
+    Region() : generation(0) {}
+    uint64_t generation;
+    // the keys appended to the region, some may have moved on since
+    std::vector<Key> keys;
+  };
+
+  // writes the open region out and recycles the next one
+  void seal_nolock() {
+    if (detail::pwriteAll(fd_, buf_.data(), buf_.size(),
+                          uint64_t(open_) * regionBytes_)) {
+      bytesWritten_ += buf_.size();
+    } else {
+      dropped_ += recycle_nolock(open_);
+    }
+    buf_.clear();
+    open_ = (open_ + 1) % regions_.size();
+    recycle_nolock(open_);
+  }
+  // drops the index entries still pointing into region r
+  size_t recycle_nolock(size_t r) {
+    size_t count = 0;
+    for (const Key& k : regions_[r].keys) {
+      const auto iter = index_.find(k);
+      if (iter != index_.end() && iter->second.region == r) {
+        index_.erase(iter);
+        ++count;
+      }
+    }
+    regions_[r].keys.clear();
+    ++regions_[r].generation;
+    return count;
+  }
+  // a record read back from the file must still be for k
+  bool decode(const Key& k, const char* p, size_t n, Value& vOut) const {
+    const char* const end = p + n;
+    const size_t keySize = static_cast<size_t>(detail::getVarint(p, end));
+    if (keySize > static_cast<size_t>(end - p) ||
+        !(serializer_.readKey(p, keySize) == k)) {
+      return false;
+    }
+    p += keySize;
+    const size_t valueSize = static_cast<size_t>(detail::getVarint(p, end));
+    if (valueSize > static_cast<size_t>(end - p)) {
+      return false;
+    }
+    vOut = serializer_.readValue(p, valueSize);
+    return true;
+  }
+
+  // Disallow copying.
+  SpillFile(const SpillFile&) = delete;
+  SpillFile& operator=(const SpillFile&) = delete;
+
+  mutable lock_type lock_;
+  int fd_;
+  size_t regionBytes_;
+  Serializer serializer_;
+  std::unordered_map<Key, Extent, Hash> index_;
+  std::vector<Region> regions_;
+  size_t open_;
+  // the open region, written out when full
+  std::string buf_;
+  std::string record_;
+  std::string scratch_;
+  uint64_t bytesWritten_;
+  uint64_t dropped_;
+};
+
+/**
+ *	An in-memory Cache (tier 1) backed by a SpillFile (tier 2). Keys live in
+ *one tier at a time: tier 1 evictions for size are spilled, tier 2 hits are
+ *promoted back into tier 1 and leave the spill file, insert() and remove()
+ *drop any spilled copy.
+ *
+ *		maxSize / elasticity - tier 1 limits, see Cache
+ *		spillPath / spillBytes / regionBytes - the tier 2 file, see SpillFile
+ *
+ *	Concurrency follows Lock (pass std::mutex to share the cache between
+ *threads); tier 2 reads never hold a lock across the pread(). Writes
+ *(insert(), remove() and promotions) are serialized together with the
+ *spill appends of the evictions they cause, so a value evicted just before
+ *a concurrent remove() or insert() of its key can't land in the spill file
+ *after that write and come back on a later miss.
+ */
+template <class Key, class Value, class Lock = NullLock,
+          class Serializer = SnapshotSerializer<Key, Value>,
+          class Hash = std::hash<Key>>
+class TieredCache {
+ public:
+  typedef Cache<Key, Value, Lock, std::unordered_map<Key, Value, Hash>>
+      memory_type;
+  typedef SpillFile<Key, Value, Lock, Serializer, Hash> spill_type;
+  typedef Lock lock_type;
+  using Guard = std::lock_guard<lock_type>;
+
+  TieredCache(size_t maxSize, size_t elasticity, const std::string& spillPath,
+              size_t spillBytes, size_t regionBytes = 1 << 20,
+              const Serializer& s = Serializer())
+      : spill_(spillPath, spillBytes, regionBytes, s),
+        memory_(maxSize, elasticity),
+        spillHits_(0) {
+    for (auto& w : writes_) {
+      w.store(0, std::memory_order_relaxed);
+    }
+    // runs inside the memory_ write that evicted k, under writeLock_
+    spill_type* spill = &spill_;
+    memory_.setRemovalListener(
+        [spill](const Key& k, Value& v, RemovalCause cause) {
+          if (cause == RemovalCause::kSize) {
+            spill->append(k, v);
+          }
+        });
+  }
+  virtual ~TieredCache() = default;
+
+  void insert(const Key& k, Value v) {
+    Guard g(writeLock_);
+    bumpWrites(k);
+    spill_.erase(k);
+    memory_.insert(k, std::move(v));
+  }
+  /**
+   * tier 1, then tier 2. a tier 2 hit is promoted into tier 1 (unless a
+   * newer value got there first, which is returned instead). a hit read
+   * while its key was being written is returned but not promoted
+   */
+  bool tryGet(const Key& k, Value& vOut) {
+    if (memory_.tryGet(k, vOut)) {
+      return true;
+    }
+    const uint64_t seen = writesOf(k).load(std::memory_order_acquire);
+    if (!spill_.take(k, vOut)) {
+      return false;
+    }
+    spillHits_.fetch_add(1, std::memory_order_relaxed);
+    Guard g(writeLock_);
+    if (writesOf(k).load(std::memory_order_relaxed) != seen ||
+        !memory_.emplace(k, vOut)) {
+      memory_.tryPeek(k, vOut);
+    }
+    return true;
+  }
+  Value get(const Key& k) {
+    Value v;
+    if (!tryGet(k, v)) {
+      throw KeyNotFound();
+    }
+    return v;
+  }
+  bool remove(const Key& k) {
+    Guard g(writeLock_);
+    bumpWrites(k);
+    const bool spilled = spill_.erase(k);
+    return memory_.remove(k) || spilled;
+  }
+  // in either tier, promotes nothing
+  bool contains(const Key& k) const {
+    return memory_.contains(k) || spill_.contains(k);
+  }
+  // the tier 1 entry count, see spilledSize()
+  size_t size() const { return memory_.size(); }
+  size_t spilledSize() const { return spill_.size(); }
+  // tier 2 hits so far
+  uint64_t spillHits() const {
+    return spillHits_.load(std::memory_order_relaxed);
+  }
+  const memory_type& memory() const { return memory_; }
+  const spill_type& spill() const { return spill_; }
+
+ private:
+  // Disallow copying.
+  TieredCache(const TieredCache&) = delete;
+  TieredCache& operator=(const TieredCache&) = delete;
+
+  // insert() / remove() count per key stripe, so a promotion can tell that
+  // its key was written while it read the spill file
+  static const size_t kWriteStripes = 64;
+  std::atomic<uint64_t>& writesOf(const Key& k) {
+    return writes_[hash_(k) % kWriteStripes];
+  }
+  void bumpWrites(const Key& k) {
+    writesOf(k).fetch_add(1, std::memory_order_release);
+  }
+
+  lock_type writeLock_;
+  spill_type spill_;
+  memory_type memory_;
+  Hash hash_;
+  std::atomic<uint64_t> writes_[kWriteStripes];
+  std::atomic<uint64_t> spillHits_;
+};
+
+}  // namespace lru11
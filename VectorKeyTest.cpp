@@ -3,6 +3,7 @@
 #include<vector>
 #include<map>
 #include "LRUCache11.hpp"
+#include "LRUCache11BTree.hpp"
 
 #include<cassert>
 
@@ -23,5 +24,13 @@ int main() {
   auto ret = cache.get(key1);
   assert (ret == val1);
 
+  // an ordered index can drop every key below a prefix
+  lru11::Cache<KeyT, ValueT, mutex, lru11::BTreeMap<KeyT, ValueT>> ordered;
+  ordered.insert(KeyT{1,2,3}, val1);
+  ordered.insert(KeyT{1,2,4}, val1);
+  ordered.insert(KeyT{1,3}, val1);
+  assert (ordered.removePrefix(KeyT{1,2}) == 2);
+  assert (ordered.size() == 1 && ordered.contains(KeyT{1,3}));
+
   return 0;
 }
@@ -0,0 +1,238 @@
+/*
+ * CacheBenchmarks.cpp - google-benchmark suite for the LRUCache11 caches.
+ *
+ * Every benchmark replays a precomputed key sequence cache-aside style
+ * (tryGet, insert on a miss) against one cache shared by all threads and
+ * reports items_per_second (ops/s), the hit ratio and sampled per-op
+ * latency percentiles (p50 / p99 / p999 in ns).
+ *
+ *	lru11_bench --benchmark_filter=zipf    (only the zipfian runs)
+ *	lru11_bench --trace=keys.txt           (also replay a trace, one key
+ *	                                        per line, see Workloads.hpp)
+ *
+ * Github: https://github.com/mohaps/lrucache11
+ *
+ * Copyright (c) 2012-22 SAURAV MOHAPATRA <mohaps@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <benchmark/benchmark.h>
+
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "LRUCache11.hpp"
+#include "LRUCache11Pooled.hpp"
+#include "Workloads.hpp"
+
+using namespace lru11;
+using namespace lru11bench;
+
+namespace {
+
+typedef uint64_t K;
+typedef uint64_t V;
+typedef std::unordered_map<K, V> KVMap;
+
+// the cache variants under test, with the way each one is built
+struct LruNullLock {
+  typedef Cache<K, V> type;
+  static const char* name() { return "lru/nulllock"; }
+  static const bool kThreadSafe = false;
+  static type* make(size_t n) { return new type(n, n / 10); }
+};
+struct LruMutex {
+  typedef Cache<K, V, std::mutex> type;
+  static const char* name() { return "lru/mutex"; }
+  static const bool kThreadSafe = true;
+  static type* make(size_t n) { return new type(n, n / 10); }
+};
+struct BufferedShared {
+  typedef Cache<K, V, std::shared_timed_mutex, KVMap, BufferedLRUPolicy> type;
+  static const char* name() { return "buffered-lru/shared-mutex"; }
+  static const bool kThreadSafe = true;
+  static type* make(size_t n) { return new type(n, n / 10); }
+};
+struct ClockShared {
+  typedef Cache<K, V, std::shared_timed_mutex, KVMap, ClockPolicy> type;
+  static const char* name() { return "clock/shared-mutex"; }
+  static const bool kThreadSafe = true;
+  static type* make(size_t n) { return new type(n, n / 10); }
+};
+struct TinyLfuMutex {
+  typedef Cache<K, V, std::mutex, KVMap, TinyLFUPolicy> type;
+  static const char* name() { return "tinylfu/mutex"; }
+  static const bool kThreadSafe = true;
+  static type* make(size_t n) { return new type(n, n / 10); }
+};
+struct ShardedMutex {
+  typedef ShardedCache<K, V, std::mutex> type;
+  static const char* name() { return "sharded-lru/mutex"; }
+  static const bool kThreadSafe = true;
+  static type* make(size_t n) { return new type(n, n / 10, 16); }
+};
+struct PooledNullLock {
+  typedef PooledCache<K, V> type;
+  static const char* name() { return "pooled/nulllock"; }
+  static const bool kThreadSafe = false;
+  static type* make(size_t n) { return new type(n, n / 10); }
+};
+struct PooledMutex {
+  typedef PooledCache<K, V, std::mutex> type;
+  static const char* name() { return "pooled/mutex"; }
+  static const bool kThreadSafe = true;
+  static type* make(size_t n) { return new type(n, n / 10); }
+};
+
+enum : size_t { kSequenceLength = 1 << 20, kSampleEvery = 64 };
+
+std::string tracePath;
+
+// the key sequence of a workload, generated once per (workload, capacity)
+const std::vector<K>& keysFor(Workload w, size_t capacity) {
+  static std::mutex m;
+  static std::map<std::pair<int, size_t>, std::vector<K>> cache;
+  std::lock_guard<std::mutex> g(m);
+  const auto slot = std::make_pair(static_cast<int>(w), capacity);
+  auto it = cache.find(slot);
+  if (it == cache.end()) {
+    const uint64_t keySpace = capacity * 8;
+    std::vector<K> keys;
+    switch (w) {
+      case Workload::kZipf:
+        keys = zipfKeys(kSequenceLength, keySpace);
+        break;
+      case Workload::kUniform:
+        keys = uniformKeys(kSequenceLength, keySpace);
+        break;
+      case Workload::kScan:
+        keys = scanKeys(kSequenceLength, keySpace, capacity * 4, capacity);
+        break;
+      case Workload::kTrace:
+        keys = loadTrace(tracePath);
+        break;
+    }
+    it = cache.emplace(slot, std::move(keys)).first;
+  }
+  return it->second;
+}
+
+double percentile(std::vector<double>& samples, double p) {
+  if (samples.empty()) {
+    return 0;
+  }
+  const size_t i = std::min(samples.size() - 1,
+                            static_cast<size_t>(p * samples.size()));
+  std::nth_element(samples.begin(), samples.begin() + i, samples.end());
+  return samples[i];
+}
+
+template <class Variant>
+void cacheAside(benchmark::State& state, Workload w) {
+  typedef typename Variant::type C;
+  static std::unique_ptr<C> cache;
+  const size_t capacity = static_cast<size_t>(state.range(0));
+  const std::vector<K>& keys = keysFor(w, capacity);
+  if (state.thread_index() == 0) {
+    cache.reset(Variant::make(capacity));
+  }
+  // threads start at different points of the sequence so they don't
+  // access the same keys in lock step
+  size_t pos = keys.size() / state.threads() * state.thread_index();
+  uint64_t ops = 0;
+  uint64_t hits = 0;
+  std::vector<double> samples;
+  samples.reserve(1 << 16);
+  for (auto _ : state) {
+    const K k = keys[pos];
+    if (++pos == keys.size()) {
+      pos = 0;
+    }
+    const bool sample = (ops++ % kSampleEvery) == 0;
+    std::chrono::steady_clock::time_point start;
+    if (sample) {
+      start = std::chrono::steady_clock::now();
+    }
+    V v{};
+    if (cache->tryGet(k, v)) {
+      ++hits;
+    } else {
+      cache->insert(k, k);
+    }
+    benchmark::DoNotOptimize(v);
+    if (sample) {
+      samples.push_back(std::chrono::duration<double, std::nano>(
+                            std::chrono::steady_clock::now() - start)
+                            .count());
+    }
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(ops));
+  const auto avg = benchmark::Counter::kAvgThreads;
+  state.counters["hit_ratio"] =
+      benchmark::Counter(ops ? static_cast<double>(hits) / ops : 0, avg);
+  state.counters["p50_ns"] = benchmark::Counter(percentile(samples, 0.5), avg);
+  state.counters["p99_ns"] = benchmark::Counter(percentile(samples, 0.99), avg);
+  state.counters["p999_ns"] =
+      benchmark::Counter(percentile(samples, 0.999), avg);
+  if (state.thread_index() == 0) {
+    cache.reset();
+  }
+}
+
+template <class Variant>
+void registerVariant(const std::vector<Workload>& workloads) {
+  for (const Workload w : workloads) {
+    const std::string name =
+        std::string(workloadName(w)) + "/" + Variant::name();
+    auto* b = benchmark::RegisterBenchmark(
+        name.c_str(), [w](benchmark::State& s) { cacheAside<Variant>(s, w); });
+    b->Arg(1 << 10)->Arg(1 << 16)->UseRealTime();
+    if (Variant::kThreadSafe) {
+      b->Threads(1)->Threads(4)->Threads(8);
+    }
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  benchmark::Initialize(&argc, argv);
+  for (int i = 1; i < argc; ++i) {
+    if (std::strncmp(argv[i], "--trace=", 8) == 0) {
+      tracePath = argv[i] + 8;
+    }
+  }
+  std::vector<Workload> workloads = {Workload::kZipf, Workload::kUniform,
+                                     Workload::kScan};
+  if (!tracePath.empty()) {
+    workloads.push_back(Workload::kTrace);
+  }
+  registerVariant<LruNullLock>(workloads);
+  registerVariant<LruMutex>(workloads);
+  registerVariant<BufferedShared>(workloads);
+  registerVariant<ClockShared>(workloads);
+  registerVariant<TinyLfuMutex>(workloads);
+  registerVariant<ShardedMutex>(workloads);
+  registerVariant<PooledNullLock>(workloads);
+  registerVariant<PooledMutex>(workloads);
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -0,0 +1,326 @@
+/*
+ * StressTest.cpp - concurrency stress and scalability across the locking
+ * modes.
+ *
+ * Runs a mixed get / insert / remove workload over zipf distributed keys
+ * against every cache variant at 1, 2, 4 ... N threads. While the workers
+ * run, a checker thread periodically verifies checkInvariants() (map and
+ * list agree, every map entry points at its key's node) and the capacity,
+ * and every value a worker reads is checked against its key. Prints the
+ * throughput, the speedup over one thread and the share of thread time
+ * spent waiting for the cache lock (AtomicStats<true>), and exits with 1
+ * on any violation. Configure with -DLRU11_STRESS_TSAN=ON to build it with
+ * ThreadSanitizer.
+ *
+ *	lru11_stress [--threads=N] [--ops=N] [--keys=N] [--capacity=N]
+ *	             [--mix=get,insert,remove] [--no-check] [--only=mode]
+ *
+ * Github: https://github.com/mohaps/lrucache11
+ *
+ * Copyright (c) 2012-22 SAURAV MOHAPATRA <mohaps@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "LRUCache11.hpp"
+#include "LRUCache11Pooled.hpp"
+#include "Workloads.hpp"
+
+using namespace lru11;
+
+namespace {
+
+typedef uint64_t K;
+// the key is stored in the value too, so a read can tell it got its own
+struct Payload {
+  uint64_t key;
+  uint64_t seq;
+};
+
+struct Options {
+  size_t threads = std::max(1u, std::thread::hardware_concurrency());
+  size_t opsPerThread = 200000;
+  uint64_t keys = 100000;
+  size_t capacity = 10000;
+  unsigned getPct = 80;
+  unsigned insertPct = 15;
+  bool check = true;
+  std::string only;
+};
+
+struct Result {
+  double seconds = 0;
+  uint64_t ops = 0;
+  uint64_t lockWaits = 0;
+  uint64_t lockWaitNanos = 0;
+  double hitRatio = -1;
+  std::vector<std::string> failures;
+};
+
+// lock wait and hit ratio from getStats(), where the cache has one
+template <class C>
+auto collectStats(const C& c, Result& r, int) -> decltype(c.getStats(), void()) {
+  const StatsSnapshot s = c.getStats();
+  r.lockWaits = s.lockWaits;
+  r.lockWaitNanos = s.lockWaitNanos;
+  r.hitRatio = s.hitRatio();
+}
+template <class C>
+void collectStats(const C&, Result&, long) {}
+
+template <class C>
+Result runOnce(C& cache, size_t threads, const Options& o,
+               const std::vector<uint64_t>& keys) {
+  Result r;
+  std::mutex failMutex;
+  std::atomic<bool> failed(false);
+  auto fail = [&](const std::string& what) {
+    std::lock_guard<std::mutex> g(failMutex);
+    if (r.failures.size() < 10) {
+      r.failures.push_back(what);
+    }
+    failed.store(true);
+  };
+  const size_t maxAllowed = cache.getMaxAllowedSize();
+
+  std::atomic<size_t> ready(0);
+  std::atomic<bool> go(false);
+  std::atomic<size_t> running(threads);
+  std::vector<std::thread> workers;
+  for (size_t t = 0; t < threads; ++t) {
+    workers.emplace_back([&, t]() {
+      std::minstd_rand rng(static_cast<unsigned>(t + 1));
+      const uint64_t* k = keys.data() + t * o.opsPerThread;
+      ready.fetch_add(1);
+      while (!go.load()) {
+        std::this_thread::yield();
+      }
+      Payload v;
+      for (size_t i = 0; i < o.opsPerThread && !failed.load(std::memory_order_relaxed); ++i) {
+        const unsigned pick = rng() % 100;
+        if (pick < o.getPct) {
+          if (cache.tryGet(k[i], v)) {
+            if (v.key != k[i]) {
+              fail("tryGet returned the value of another key");
+            }
+          } else {
+            cache.insert(k[i], Payload{k[i], i});
+          }
+        } else if (pick < o.getPct + o.insertPct) {
+          cache.insert(k[i], Payload{k[i], i});
+        } else {
+          cache.remove(k[i]);
+        }
+      }
+      running.fetch_sub(1);
+    });
+  }
+  std::thread checker;
+  if (o.check) {
+    checker = std::thread([&]() {
+      while (ready.load() != threads || !go.load()) {
+        std::this_thread::yield();
+      }
+      while (running.load() != 0) {
+        if (!cache.checkInvariants()) {
+          fail("checkInvariants() failed while running");
+        }
+        if (cache.size() > maxAllowed) {
+          fail("size() over getMaxAllowedSize() while running");
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      }
+    });
+  }
+  while (ready.load() != threads) {
+    std::this_thread::yield();
+  }
+  const auto start = std::chrono::steady_clock::now();
+  go.store(true);
+  for (auto& w : workers) {
+    w.join();
+  }
+  r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                            start)
+                  .count();
+  if (checker.joinable()) {
+    checker.join();
+  }
+  if (!cache.checkInvariants()) {
+    fail("checkInvariants() failed after the run");
+  }
+  if (cache.size() > maxAllowed) {
+    fail("size() over getMaxAllowedSize() after the run");
+  }
+  r.ops = threads * o.opsPerThread;
+  collectStats(cache, r, 0);
+  return r;
+}
+
+std::vector<size_t> threadCounts(size_t n) {
+  std::vector<size_t> counts;
+  for (size_t t = 1; t < n; t *= 2) {
+    counts.push_back(t);
+  }
+  counts.push_back(n);
+  return counts;
+}
+
+// runs one mode at every thread count, printing a row per run
+template <class Make>
+bool runMode(const char* name, Make make, const Options& o,
+             const std::vector<uint64_t>& keys) {
+  if (!o.only.empty() && o.only != name) {
+    return true;
+  }
+  bool ok = true;
+  double base = 0;
+  for (size_t threads : threadCounts(o.threads)) {
+    auto cache = make(o.capacity);
+    const Result r = runOnce(*cache, threads, o, keys);
+    const double mops = r.ops / r.seconds / 1e6;
+    if (threads == 1) {
+      base = mops;
+    }
+    char waits[64];
+    char hits[16];
+    if (r.hitRatio < 0) {
+      std::snprintf(waits, sizeof(waits), "%12s %8s", "-", "-");
+      std::snprintf(hits, sizeof(hits), "%7s", "-");
+    } else {
+      std::snprintf(waits, sizeof(waits), "%12llu %7.1f%%",
+                    static_cast<unsigned long long>(r.lockWaits),
+                    100.0 * r.lockWaitNanos / (1e9 * r.seconds * threads));
+      std::snprintf(hits, sizeof(hits), "%6.1f%%", 100.0 * r.hitRatio);
+    }
+    std::printf("%-22s %7zu %9.2f %7.2fx %s %s %s\n", name, threads, mops,
+                base > 0 ? mops / base : 0.0, waits, hits,
+                r.failures.empty() ? "ok" : "FAILED");
+    for (const auto& f : r.failures) {
+      std::printf("    %s\n", f.c_str());
+    }
+    ok = ok && r.failures.empty();
+  }
+  return ok;
+}
+
+template <class C>
+std::unique_ptr<C> makeCache(size_t capacity) {
+  return std::unique_ptr<C>(new C(capacity, capacity / 10));
+}
+template <class C>
+std::unique_ptr<C> makeSharded(size_t capacity) {
+  return std::unique_ptr<C>(new C(capacity, capacity / 10, 16));
+}
+
+int usage() {
+  std::cerr << "usage: lru11_stress [--threads=N] [--ops=N] [--keys=N]"
+               " [--capacity=N] [--mix=get,insert,remove] [--no-check]"
+               " [--only=mode]"
+            << std::endl;
+  return 2;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options o;
+  for (int i = 1; i < argc; ++i) {
+    const std::string a = argv[i];
+    const size_t eq = a.find('=');
+    const std::string value = eq == std::string::npos ? "" : a.substr(eq + 1);
+    const std::string flag = a.substr(0, eq);
+    if (flag == "--threads") {
+      o.threads = std::max<size_t>(1, std::strtoul(value.c_str(), nullptr, 10));
+    } else if (flag == "--ops") {
+      o.opsPerThread = std::strtoul(value.c_str(), nullptr, 10);
+    } else if (flag == "--keys") {
+      o.keys = std::max<uint64_t>(1, std::strtoull(value.c_str(), nullptr, 10));
+    } else if (flag == "--capacity") {
+      o.capacity = std::max<size_t>(1, std::strtoul(value.c_str(), nullptr, 10));
+    } else if (flag == "--mix") {
+      unsigned get = 0, insert = 0, remove = 0;
+      if (std::sscanf(value.c_str(), "%u,%u,%u", &get, &insert, &remove) != 3 ||
+          get + insert + remove != 100) {
+        return usage();
+      }
+      o.getPct = get;
+      o.insertPct = insert;
+    } else if (a == "--no-check") {
+      o.check = false;
+    } else if (flag == "--only") {
+      o.only = value;
+    } else {
+      return usage();
+    }
+  }
+
+  const std::vector<uint64_t> keys =
+      lru11bench::zipfKeys(o.threads * o.opsPerThread, o.keys);
+  std::printf("%zu ops per thread, %llu zipf keys, capacity %zu, mix %u/%u/%u%s\n",
+              o.opsPerThread, static_cast<unsigned long long>(o.keys),
+              o.capacity, o.getPct, o.insertPct, 100 - o.getPct - o.insertPct,
+              o.check ? "" : ", invariant checks off");
+  std::printf("%-22s %7s %9s %8s %12s %8s %7s\n", "mode", "threads", "Mops/s",
+              "speedup", "lock waits", "waiting", "hits");
+
+  typedef UseStats<AtomicStats<true>> Timed;
+  typedef std::shared_timed_mutex RW;
+  bool ok = true;
+  ok &= runMode("lru/mutex",
+                makeCache<Cache<K, Payload, Policies<UseLock<std::mutex>, Timed>>>,
+                o, keys);
+  ok &= runMode("lru/rwlock",
+                makeCache<Cache<K, Payload, Policies<UseLock<RW>, Timed>>>, o,
+                keys);
+  ok &= runMode("buffered-lru/rwlock",
+                makeCache<Cache<K, Payload,
+                                Policies<UseLock<RW>,
+                                         UseEviction<BufferedLRUPolicy>, Timed>>>,
+                o, keys);
+  ok &= runMode("clock/rwlock",
+                makeCache<Cache<K, Payload,
+                                Policies<UseLock<RW>, UseEviction<ClockPolicy>,
+                                         Timed>>>,
+                o, keys);
+  ok &= runMode("tinylfu/mutex",
+                makeCache<Cache<K, Payload,
+                                Policies<UseLock<std::mutex>,
+                                         UseEviction<TinyLFUPolicy>, Timed>>>,
+                o, keys);
+  ok &= runMode("sharded16-lru/mutex",
+                makeSharded<ShardedCache<K, Payload,
+                                         Policies<UseLock<std::mutex>, Timed>>>,
+                o, keys);
+  ok &= runMode("sharded16-clock/rwlock",
+                makeSharded<ShardedCache<K, Payload,
+                                         Policies<UseLock<RW>,
+                                                  UseEviction<ClockPolicy>,
+                                                  Timed>>>,
+                o, keys);
+  ok &= runMode("pooled/mutex", makeCache<PooledCache<K, Payload, std::mutex>>,
+                o, keys);
+  return ok ? 0 : 1;
+}
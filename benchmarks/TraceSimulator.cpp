@@ -0,0 +1,372 @@
+/*
+ * TraceSimulator.cpp - hit ratio curves for capacity planning.
+ *
+ * Streams a key trace once and prints, for a range of capacities, the hit
+ * ratio of an exact LRU computed from Mattson stack distances (one pass
+ * gives every capacity), next to the hit ratios of real lru11 caches
+ * (LRU with the given elasticity, CLOCK, W-TinyLFU) fed from the same
+ * pass.
+ *
+ *	lru11_sim [--format=text|u64] [--capacities=1000,10000,...]
+ *	          [--min=1024 --max=1048576 --steps=11] [--elasticity=10%]
+ *	          [--stack-only] trace
+ *
+ *	text traces have one key per line (numbers are used as is, anything
+ *	else is hashed), u64 traces are raw native endian 64 bit keys. Traces
+ *	are memory-mapped where the platform allows. Output is CSV.
+ *
+ * Github: https://github.com/mohaps/lrucache11
+ *
+ * Copyright (c) 2012-22 SAURAV MOHAPATRA <mohaps@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define LRU11_SIM_MMAP 1
+#endif
+
+#include "LRUCache11.hpp"
+#include "Workloads.hpp"
+
+using namespace lru11;
+
+namespace {
+
+/*
+ * a read only view of the whole trace file, mapped where possible and
+ * read into memory otherwise
+ */
+class TraceFile {
+ public:
+  explicit TraceFile(const std::string& path) : data_(nullptr), size_(0) {
+#ifdef LRU11_SIM_MMAP
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw std::runtime_error("cannot open trace " + path);
+    }
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+      size_ = static_cast<size_t>(st.st_size);
+      void* p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p != MAP_FAILED) {
+        ::madvise(p, size_, MADV_SEQUENTIAL);
+        data_ = static_cast<const char*>(p);
+      }
+    }
+    ::close(fd);
+    if (data_ != nullptr || size_ == 0) {
+      return;
+    }
+#endif
+    std::ifstream in(path.c_str(), std::ios::binary);
+    if (!in) {
+      throw std::runtime_error("cannot open trace " + path);
+    }
+    copy_.assign(std::istreambuf_iterator<char>(in),
+                 std::istreambuf_iterator<char>());
+    size_ = copy_.size();
+  }
+  ~TraceFile() {
+#ifdef LRU11_SIM_MMAP
+    if (data_ != nullptr) {
+      ::munmap(const_cast<char*>(data_), size_);
+    }
+#endif
+  }
+  const char* begin() const { return data_ ? data_ : copy_.data(); }
+  const char* end() const { return begin() + size_; }
+
+ private:
+  TraceFile(const TraceFile&) = delete;
+  TraceFile& operator=(const TraceFile&) = delete;
+
+  const char* data_;
+  size_t size_;
+  std::vector<char> copy_;
+};
+
+template <class F>
+void forEachKey(const TraceFile& t, bool binary, F&& f) {
+  if (binary) {
+    for (const char* p = t.begin(); p + sizeof(uint64_t) <= t.end();
+         p += sizeof(uint64_t)) {
+      uint64_t k;
+      std::memcpy(&k, p, sizeof(k));
+      f(k);
+    }
+    return;
+  }
+  const char* line = t.begin();
+  while (line < t.end()) {
+    const char* eol =
+        static_cast<const char*>(std::memchr(line, '\n', t.end() - line));
+    if (eol == nullptr) {
+      eol = t.end();
+    }
+    const char* last = eol;
+    if (last > line && last[-1] == '\r') {
+      --last;
+    }
+    if (last > line) {
+      f(lru11bench::parseKey(line, last));
+    }
+    line = eol + 1;
+  }
+}
+
+/*
+ * Mattson's stack algorithm for LRU: the stack distance of an access is the
+ * number of distinct keys touched since the previous access to the same
+ * key, and an LRU cache of capacity C hits exactly the accesses with a
+ * distance < C. Distances are counted with a Fenwick tree over access
+ * times holding a 1 at each key's latest access, O(log n) per access. The
+ * times are renumbered when the tree fills up, so its size stays
+ * proportional to the number of distinct keys, not the trace length.
+ */
+class StackDistances {
+ public:
+  StackDistances() : now_(0) { resize(1 << 20); }
+
+  // the stack distance of k, or -1 for the first access
+  int64_t access(uint64_t k) {
+    if (now_ == tree_.size()) {
+      compact();
+    }
+    int64_t distance = -1;
+    const auto slot = last_.emplace(k, now_);
+    if (!slot.second) {
+      const uint64_t prev = slot.first->second;
+      distance = static_cast<int64_t>(sum(now_) - sum(prev + 1));
+      add(prev, -1);
+      slot.first->second = now_;
+    }
+    add(now_++, 1);
+    return distance;
+  }
+  size_t distinct() const { return last_.size(); }
+
+ private:
+  void resize(size_t n) { tree_.assign(n, 0); }
+  // prefix sum of [0, i)
+  int64_t sum(uint64_t i) const {
+    int64_t s = 0;
+    for (; i > 0; i &= i - 1) {
+      s += tree_[i - 1];
+    }
+    return s;
+  }
+  void add(uint64_t i, int32_t d) {
+    for (++i; i <= tree_.size(); i += i & (~i + 1)) {
+      tree_[i - 1] += d;
+    }
+  }
+  // renumbers the live times 0..distinct-1 in their current order
+  void compact() {
+    std::vector<std::pair<uint64_t, uint64_t>> byTime;
+    byTime.reserve(last_.size());
+    for (const auto& kv : last_) {
+      byTime.emplace_back(kv.second, kv.first);
+    }
+    std::sort(byTime.begin(), byTime.end());
+    resize(std::max<size_t>(tree_.size(), 2 * byTime.size()));
+    now_ = 0;
+    for (const auto& tk : byTime) {
+      last_[tk.second] = now_;
+      add(now_++, 1);
+    }
+  }
+
+  std::unordered_map<uint64_t, uint64_t> last_;
+  std::vector<int32_t> tree_;
+  uint64_t now_;
+};
+
+// a real cache of one policy and capacity, fed cache-aside
+class SimulatedCache {
+ public:
+  SimulatedCache() : hits(0) {}
+  virtual ~SimulatedCache() {}
+  virtual void access(uint64_t k) = 0;
+  uint64_t hits;
+};
+template <class Policy>
+class PolicyCache : public SimulatedCache {
+ public:
+  PolicyCache(size_t capacity, size_t elasticity)
+      : cache_(capacity, elasticity) {}
+  void access(uint64_t k) override {
+    char v;
+    if (cache_.tryGet(k, v)) {
+      ++hits;
+    } else {
+      cache_.insert(k, 0);
+    }
+  }
+
+ private:
+  Cache<uint64_t, char, NullLock, std::unordered_map<uint64_t, char>, Policy>
+      cache_;
+};
+
+std::vector<size_t> parseList(const std::string& s) {
+  std::vector<size_t> out;
+  size_t pos = 0;
+  while (pos < s.size()) {
+    size_t comma = s.find(',', pos);
+    if (comma == std::string::npos) {
+      comma = s.size();
+    }
+    out.push_back(std::strtoull(s.substr(pos, comma - pos).c_str(), nullptr, 10));
+    pos = comma + 1;
+  }
+  return out;
+}
+
+int usage() {
+  std::cerr << "usage: lru11_sim [--format=text|u64] [--capacities=a,b,...]"
+               " [--min=N --max=N --steps=N] [--elasticity=N|N%]"
+               " [--stack-only] trace"
+            << std::endl;
+  return 2;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::string path;
+  bool binary = false;
+  bool stackOnly = false;
+  std::vector<size_t> capacities;
+  size_t minCap = 1024, maxCap = 1 << 20, steps = 11;
+  std::string elasticity = "10%";
+  for (int i = 1; i < argc; ++i) {
+    const std::string a = argv[i];
+    if (a == "--format=u64") {
+      binary = true;
+    } else if (a == "--format=text") {
+      binary = false;
+    } else if (a.compare(0, 13, "--capacities=") == 0) {
+      capacities = parseList(a.substr(13));
+    } else if (a.compare(0, 6, "--min=") == 0) {
+      minCap = std::strtoull(a.c_str() + 6, nullptr, 10);
+    } else if (a.compare(0, 6, "--max=") == 0) {
+      maxCap = std::strtoull(a.c_str() + 6, nullptr, 10);
+    } else if (a.compare(0, 8, "--steps=") == 0) {
+      steps = std::strtoull(a.c_str() + 8, nullptr, 10);
+    } else if (a.compare(0, 13, "--elasticity=") == 0) {
+      elasticity = a.substr(13);
+    } else if (a == "--stack-only") {
+      stackOnly = true;
+    } else if (a[0] != '-' && path.empty()) {
+      path = a;
+    } else {
+      return usage();
+    }
+  }
+  if (path.empty()) {
+    return usage();
+  }
+  if (capacities.empty()) {
+    // geometric steps from min to max
+    for (size_t i = 0; i < steps; ++i) {
+      const double f = steps > 1 ? static_cast<double>(i) / (steps - 1) : 0;
+      capacities.push_back(static_cast<size_t>(
+          std::round(minCap * std::pow(double(maxCap) / minCap, f))));
+    }
+  }
+  std::sort(capacities.begin(), capacities.end());
+  auto elasticityOf = [&elasticity](size_t capacity) {
+    const size_t n = std::strtoull(elasticity.c_str(), nullptr, 10);
+    return !elasticity.empty() && elasticity.back() == '%' ? capacity * n / 100 : n;
+  };
+
+  std::vector<std::unique_ptr<SimulatedCache>> sims;
+  static const char* const kPolicies[] = {"lru", "clock", "tinylfu"};
+  if (!stackOnly) {
+    for (const size_t c : capacities) {
+      const size_t e = elasticityOf(c);
+      sims.emplace_back(new PolicyCache<LRUPolicy>(c, e));
+      sims.emplace_back(new PolicyCache<ClockPolicy>(c, e));
+      sims.emplace_back(new PolicyCache<TinyLFUPolicy>(c, e));
+    }
+  }
+
+  // histogram of stack distances, bucketed by the capacities they hit in:
+  // an access with distance d hits every capacity > d
+  std::vector<uint64_t> hitsBelow(capacities.size(), 0);
+  StackDistances stack;
+  uint64_t accesses = 0;
+  try {
+    TraceFile trace(path);
+    forEachKey(trace, binary, [&](uint64_t k) {
+      ++accesses;
+      const int64_t d = stack.access(k);
+      if (d >= 0) {
+        const auto it = std::upper_bound(capacities.begin(), capacities.end(),
+                                         static_cast<size_t>(d));
+        if (it != capacities.end()) {
+          ++hitsBelow[it - capacities.begin()];
+        }
+      }
+      for (auto& s : sims) {
+        s->access(k);
+      }
+    });
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  std::cout << "# accesses=" << accesses << " distinct=" << stack.distinct()
+            << " max_hit_ratio="
+            << (accesses ? 1.0 - double(stack.distinct()) / accesses : 0)
+            << std::endl;
+  std::cout << "capacity,elasticity,stack_lru";
+  if (!stackOnly) {
+    for (const char* p : kPolicies) {
+      std::cout << "," << p;
+    }
+  }
+  std::cout << std::endl;
+  uint64_t cumulative = 0;
+  for (size_t i = 0; i < capacities.size(); ++i) {
+    cumulative += hitsBelow[i];
+    std::cout << capacities[i] << "," << elasticityOf(capacities[i]) << ","
+              << (accesses ? double(cumulative) / accesses : 0);
+    if (!stackOnly) {
+      for (size_t p = 0; p < 3; ++p) {
+        std::cout << ","
+                  << (accesses ? double(sims[i * 3 + p]->hits) / accesses : 0);
+      }
+    }
+    std::cout << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,143 @@
+/*
+ * Workloads.hpp - key sequences for the LRUCache11 benchmarks and the trace
+ * simulator: zipfian, uniform, scan-heavy and replayed traces.
+ *
+ * Github: https://github.com/mohaps/lrucache11
+ *
+ * Copyright (c) 2012-22 SAURAV MOHAPATRA <mohaps@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "LRUCache11.hpp"
+
+namespace lru11bench {
+
+enum class Workload { kZipf, kUniform, kScan, kTrace };
+
+inline const char* workloadName(Workload w) {
+  switch (w) {
+    case Workload::kZipf:
+      return "zipf";
+    case Workload::kUniform:
+      return "uniform";
+    case Workload::kScan:
+      return "scan";
+    case Workload::kTrace:
+      return "trace";
+  }
+  return "?";
+}
+
+// ranks are scattered over the key space so hot keys aren't neighbours
+inline uint64_t keyOfRank(uint64_t rank) { return lru11::detail::mixHash(rank); }
+
+/*
+ * n accesses over keySpace keys, rank r drawn with probability
+ * proportional to 1 / (r + 1)^skew (inverse CDF over the ranks)
+ */
+inline std::vector<uint64_t> zipfKeys(size_t n, uint64_t keySpace,
+                                      double skew = 0.99,
+                                      uint64_t seed = 42) {
+  std::vector<double> cdf(keySpace);
+  double total = 0;
+  for (uint64_t r = 0; r < keySpace; ++r) {
+    total += 1.0 / std::pow(static_cast<double>(r + 1), skew);
+    cdf[r] = total;
+  }
+  std::mt19937_64 rng(seed);
+  std::uniform_real_distribution<double> u(0, total);
+  std::vector<uint64_t> keys(n);
+  for (auto& k : keys) {
+    const auto it = std::lower_bound(cdf.begin(), cdf.end(), u(rng));
+    k = keyOfRank(static_cast<uint64_t>(it - cdf.begin()));
+  }
+  return keys;
+}
+
+inline std::vector<uint64_t> uniformKeys(size_t n, uint64_t keySpace,
+                                         uint64_t seed = 42) {
+  std::mt19937_64 rng(seed);
+  std::uniform_int_distribution<uint64_t> u(0, keySpace - 1);
+  std::vector<uint64_t> keys(n);
+  for (auto& k : keys) {
+    k = keyOfRank(u(rng));
+  }
+  return keys;
+}
+
+/*
+ * a zipfian working set interrupted by sequential scans: every
+ * scanEvery accesses, scanLength keys that are never reused (the pattern
+ * that flushes a plain LRU)
+ */
+inline std::vector<uint64_t> scanKeys(size_t n, uint64_t keySpace,
+                                      size_t scanEvery, size_t scanLength,
+                                      uint64_t seed = 42) {
+  std::vector<uint64_t> keys = zipfKeys(n, keySpace, 0.99, seed);
+  uint64_t next = keySpace;
+  for (size_t i = scanEvery; i < n; i += scanEvery + scanLength) {
+    for (size_t j = i; j < std::min(n, i + scanLength); ++j) {
+      keys[j] = keyOfRank(next++);
+    }
+  }
+  return keys;
+}
+
+/*
+ * the key of one trace line: a decimal number is used as is, anything else
+ * (e.g. a URL or an object id) is hashed
+ */
+inline uint64_t parseKey(const char* first, const char* last) {
+  uint64_t v = 0;
+  for (const char* p = first; p != last; ++p) {
+    if (*p < '0' || *p > '9') {
+      return std::hash<std::string>()(std::string(first, last));
+    }
+    v = v * 10 + static_cast<uint64_t>(*p - '0');
+  }
+  return v;
+}
+
+/*
+ * one access per line, see parseKey()
+ */
+inline std::vector<uint64_t> loadTrace(const std::string& path) {
+  std::ifstream in(path.c_str());
+  if (!in) {
+    throw std::runtime_error("cannot open trace " + path);
+  }
+  std::vector<uint64_t> keys;
+  std::string line;
+  while (std::getline(in, line)) {
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    if (!line.empty()) {
+      keys.push_back(parseKey(line.data(), line.data() + line.size()));
+    }
+  }
+  return keys;
+}
+
+}  // namespace lru11bench